@@ -5,12 +5,58 @@
 #include <linux/uaccess.h> // copy_to_user, copy_from_user: giao tiếp user-kernel
 #include <linux/cdev.h>	   // Cấu trúc và hàm cdev cho character device
 #include <linux/device.h>  // class_create, device_create
-#include <linux/delay.h>   // msleep, udelay...
+#include <linux/slab.h>	   // kzalloc/kfree
+#include <linux/mutex.h>   // Khoá bảo vệ bus I2C và mẫu đã đo
+#include <linux/workqueue.h> // delayed_work: đọc mẫu định kỳ
+#include <linux/timekeeping.h> // ktime_get_ns: tuổi của mẫu
+#include <linux/math64.h>  // div_u64
+#include <linux/poll.h>	   // poll/select/epoll
+#include <linux/wait.h>	   // Hàng đợi cho poll()
+#include "bh1750_uapi.h"   // Định dạng nhị phân và ioctl
 
 #define DRIVER_NAME "bh1750" // Tên driver
 #define BH1750_I2C_ADDR 0x23 // Địa chỉ mặc định của cảm biến BH1750
-#define BH1750_CMD_CONT_HRES \
-	0x10 // Lệnh đo liên tục, độ phân giải cao (datasheet)
+#define BH1750_CMD_POWER_DOWN 0x00
+#define BH1750_CMD_POWER_ON 0x01
+#define BH1750_CMD_MTREG_HI 0x40 // 01000_MT[7:5]
+#define BH1750_CMD_MTREG_LO 0x60 // 011_MT[4:0]
+
+#define BH1750_MTREG_DEFAULT 69 // Giá trị MTreg mà bảng thời gian dựa vào
+#define BH1750_MTREG_MIN 31
+#define BH1750_MTREG_MAX 254
+
+#define BH1750_HIST 32 // Số mẫu giữ lại cho read() nhị phân
+
+/*
+ * ==== Bảng chế độ đo (datasheet) ====
+ * conv_ms là thời gian chuyển đổi tối đa ở MTreg = 69, tỉ lệ thuận với
+ * MTreg. H-res2 có độ phân giải 0.5 lx nên raw gấp đôi H-res.
+ */
+enum {
+	BH1750_MODE_CONT_HRES,
+	BH1750_MODE_CONT_HRES2,
+	BH1750_MODE_CONT_LRES,
+	BH1750_MODE_ONE_HRES,
+	BH1750_MODE_ONE_HRES2,
+	BH1750_MODE_ONE_LRES,
+};
+
+struct bh1750_mode {
+	const char *name; // Tên dùng trong sysfs
+	u8 cmd;		  // Lệnh đo
+	u16 conv_ms;	  // Thời gian chuyển đổi tối đa ở MTreg mặc định
+	bool one_time;	  // Tự power down sau mỗi lần đo
+	u8 lsb_div;	  // H-res2: 0.5 lx mỗi LSB nên chia thêm 2
+};
+
+static const struct bh1750_mode bh1750_modes[] = {
+	[BH1750_MODE_CONT_HRES] = { "cont_hres", 0x10, 180, false, 1 },
+	[BH1750_MODE_CONT_HRES2] = { "cont_hres2", 0x11, 180, false, 2 },
+	[BH1750_MODE_CONT_LRES] = { "cont_lres", 0x13, 24, false, 1 },
+	[BH1750_MODE_ONE_HRES] = { "one_hres", 0x20, 180, true, 1 },
+	[BH1750_MODE_ONE_HRES2] = { "one_hres2", 0x21, 180, true, 2 },
+	[BH1750_MODE_ONE_LRES] = { "one_lres", 0x23, 24, true, 1 },
+};
 
 static struct i2c_client
 	*bh1750_client;				   // Con trỏ đến struct đại diện cho thiết bị I2C
@@ -18,48 +64,313 @@ static dev_t dev_num;			   // Mã thiết bị (major:minor)
 static struct cdev bh1750_cdev;	   // Character device cấu trúc chính
 static struct class *bh1750_class; // Lớp thiết bị dùng để tạo /dev/bh1750
 
-/* ==== Hàm đọc ánh sáng từ BH1750 qua I2C ==== */
-static int bh1750_read_lux(uint16_t *raw_lux)
+/*
+ * ==== Bộ đo liên tục ====
+ * Khi có file đang mở, cảm biến đo theo bh1750_mode và delayed_work đọc
+ * mẫu mới sau mỗi lần chuyển đổi vào bộ nhớ đệm (ở chế độ one-time thì
+ * gửi lại lệnh đo mỗi chu kỳ). read() trả ngay mẫu trong bộ đệm kèm
+ * tuổi của nó, không gửi lệnh và không ngủ.
+ */
+static DEFINE_MUTEX(bh1750_lock);	 // Bảo vệ bus và mẫu trong bộ đệm
+static DEFINE_MUTEX(bh1750_engine_lock); // Bật/tắt bộ đo, bh1750_users
+static DECLARE_WAIT_QUEUE_HEAD(bh1750_wq); // Đánh thức read()/poll() khi có mẫu
+static struct fasync_struct *bh1750_async; // SIGIO khi có mẫu
+static unsigned int bh1750_users; // Số file đang mở
+static struct bh1750_sample bh1750_hist[BH1750_HIST]; // Mẫu seq ở [(seq - 1) % BH1750_HIST]
+static u64 bh1750_sample_seq;	  // Số thứ tự mẫu mới nhất, 0 = chưa có mẫu
+static int bh1750_sample_err;	  // Lỗi của lần đọc gần nhất
+static unsigned int bh1750_mode = BH1750_MODE_CONT_HRES; // Chỉ số trong bh1750_modes
+static unsigned int bh1750_mtreg = BH1750_MTREG_DEFAULT; // Thanh ghi thời gian đo
+static void bh1750_poll_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(bh1750_poll_work, bh1750_poll_work_fn);
+
+// Trạng thái riêng của mỗi file đang mở
+struct bh1750_file {
+	u64 seen_seq; // Mẫu cuối cùng file này đã đọc
+	u32 format;   // enum bh1750_format
+};
+
+/* ==== Đọc 2 byte kết quả đo từ BH1750 qua I2C ==== */
+static int bh1750_read_raw(uint16_t *raw_lux)
 {
 	int ret;
-	int8_t buf[2];
+	uint8_t buf[2];
 
-	// Gửi lệnh đo liên tục (CONTINUOUS HIGH RESOLUTION MODE)
-	ret = i2c_smbus_write_byte(bh1750_client, BH1750_CMD_CONT_HRES);
+	ret = i2c_master_recv(bh1750_client, buf, 2);
 	if (ret < 0)
 		return ret;
+	if (ret != 2)
+		return -EIO;
 
-	msleep(180); // Đợi cảm biến thực hiện đo (theo datasheet cần ~180ms)
+	// Chuyển 2 byte thành giá trị thô (theo datasheet: lux = raw / 1.2)
+	*raw_lux = ((buf[0] << 8) | buf[1]);
 
-	// Đọc 2 byte dữ liệu ánh sáng từ cảm biến
-	ret = i2c_master_recv(bh1750_client, buf, 2);
-	if (ret < 0)
+	return 0;
+}
+
+/*
+ * Độ rọi x1000 theo datasheet: lux = raw / 1.2 * (69 / MTreg),
+ * chia thêm 2 ở H-res2. Tính bằng số nguyên, không cần bc ở userspace.
+ */
+static u32 bh1750_milli_lux(u16 raw, unsigned int mode, unsigned int mtreg)
+{
+	return div_u64((u64)raw * 10000 * BH1750_MTREG_DEFAULT,
+		       12 * mtreg * bh1750_modes[mode].lsb_div);
+}
+
+static struct bh1750_sample *bh1750_hist_at(u64 seq)
+{
+	return &bh1750_hist[(seq - 1) % BH1750_HIST];
+}
+
+// Thời gian chuyển đổi của chế độ hiện tại, tỉ lệ theo MTreg
+static unsigned int bh1750_conv_ms(void)
+{
+	return DIV_ROUND_UP(bh1750_modes[bh1750_mode].conv_ms * bh1750_mtreg,
+			    BH1750_MTREG_DEFAULT);
+}
+
+// Nạp MTreg và lệnh đo vào cảm biến, gọi khi giữ bh1750_lock
+static int bh1750_program(void)
+{
+	u8 cmds[] = {
+		BH1750_CMD_POWER_ON,
+		BH1750_CMD_MTREG_HI | (bh1750_mtreg >> 5),
+		BH1750_CMD_MTREG_LO | (bh1750_mtreg & 0x1f),
+		bh1750_modes[bh1750_mode].cmd,
+	};
+	int ret;
+
+	if (!bh1750_client)
+		return -ENODEV;
+
+	for (int i = 0; i < ARRAY_SIZE(cmds); i++) {
+		ret = i2c_smbus_write_byte(bh1750_client, cmds[i]);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+// Làm mới bộ đệm theo chu kỳ chuyển đổi của cảm biến
+static void bh1750_poll_work_fn(struct work_struct *work)
+{
+	unsigned int period;
+	uint16_t raw;
+	int ret;
+
+	mutex_lock(&bh1750_lock);
+	if (!bh1750_client) {
+		mutex_unlock(&bh1750_lock);
+		return;
+	}
+	ret = bh1750_read_raw(&raw);
+	if (!ret) {
+		struct bh1750_sample *smp = bh1750_hist_at(bh1750_sample_seq + 1);
+
+		smp->seq = bh1750_sample_seq + 1;
+		smp->timestamp_ns = ktime_get_ns();
+		smp->raw = raw;
+		smp->milli_lux = bh1750_milli_lux(raw, bh1750_mode, bh1750_mtreg);
+		smp->mode = bh1750_mode;
+		smp->mtreg = bh1750_mtreg;
+		bh1750_sample_seq = smp->seq;
+	}
+	bh1750_sample_err = ret;
+
+	// Chế độ one-time: bắt đầu lần đo tiếp theo
+	if (bh1750_modes[bh1750_mode].one_time)
+		i2c_smbus_write_byte(bh1750_client,
+				     bh1750_modes[bh1750_mode].cmd);
+	period = bh1750_conv_ms();
+	mutex_unlock(&bh1750_lock);
+
+	// Báo cho read()/poll()/epoll và các tiến trình đăng ký SIGIO
+	wake_up_interruptible(&bh1750_wq);
+	if (!ret)
+		kill_fasync(&bh1750_async, SIGIO, POLL_IN);
+
+	schedule_delayed_work(&bh1750_poll_work, msecs_to_jiffies(period));
+}
+
+// File đầu tiên mở: bắt đầu đo theo chế độ đã chọn
+static int bh1750_engine_get(void)
+{
+	unsigned int period;
+	int ret = 0;
+
+	mutex_lock(&bh1750_engine_lock);
+	if (bh1750_users == 0) {
+		mutex_lock(&bh1750_lock);
+		ret = bh1750_program();
+		period = bh1750_conv_ms();
+		// Mẫu cũ không còn đúng sau khi cảm biến đã tắt
+		bh1750_sample_seq = 0;
+		bh1750_sample_err = 0;
+		mutex_unlock(&bh1750_lock);
+		if (ret < 0)
+			goto out;
+		// Mẫu đầu tiên sẵn sàng sau một lần chuyển đổi
+		schedule_delayed_work(&bh1750_poll_work,
+				      msecs_to_jiffies(period));
+	}
+	bh1750_users++;
+out:
+	mutex_unlock(&bh1750_engine_lock);
+	return ret;
+}
+
+// File cuối cùng đóng: dừng đọc định kỳ và cho cảm biến ngủ
+static void bh1750_engine_put(void)
+{
+	mutex_lock(&bh1750_engine_lock);
+	if (--bh1750_users == 0) {
+		cancel_delayed_work_sync(&bh1750_poll_work);
+		mutex_lock(&bh1750_lock);
+		if (bh1750_client)
+			i2c_smbus_write_byte(bh1750_client,
+					     BH1750_CMD_POWER_DOWN);
+		mutex_unlock(&bh1750_lock);
+	}
+	mutex_unlock(&bh1750_engine_lock);
+}
+
+/* ==== Hàm open()/release() của file /dev/bh1750 ==== */
+static int bh1750_open(struct inode *inode, struct file *file)
+{
+	struct bh1750_file *f;
+	int ret;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	ret = bh1750_engine_get();
+	if (ret < 0) {
+		kfree(f);
 		return ret;
+	}
 
-	// Chuyển 2 byte thành giá trị lux (theo datasheet: lux = raw / 1.2)
-	*raw_lux = ((buf[0] << 8) | buf[1]);
+	file->private_data = f;
+	return 0;
+}
 
+static int bh1750_fasync(int fd, struct file *file, int on)
+{
+	return fasync_helper(fd, file, on, &bh1750_async);
+}
+
+static int bh1750_release(struct inode *inode, struct file *file)
+{
+	bh1750_fasync(-1, file, 0);
+	bh1750_engine_put();
+	kfree(file->private_data);
 	return 0;
 }
 
-/* ==== Hàm read() của file /dev/bh1750 ==== */
+/*
+ * ==== read() nhị phân ====
+ * Trả mọi mẫu file chưa đọc (cũ trước), tối đa vừa buffer của người gọi.
+ * Mẫu đã bị ghi đè trong bh1750_hist được bỏ qua, seq bị nhảy.
+ */
+static ssize_t bh1750_read_binary(struct bh1750_file *f, struct file *file,
+				  char __user *buf, size_t count)
+{
+	const size_t rec = sizeof(struct bh1750_sample);
+	size_t n = 0, max = count / rec;
+	u64 seq;
+	int ret, err;
+
+	if (!max)
+		return -EINVAL;
+
+	if (READ_ONCE(bh1750_sample_seq) == f->seen_seq) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(bh1750_wq,
+					       READ_ONCE(bh1750_sample_seq) != f->seen_seq ||
+					       READ_ONCE(bh1750_sample_err) ||
+					       !READ_ONCE(bh1750_client));
+		if (ret)
+			return ret;
+	}
+
+	mutex_lock(&bh1750_lock);
+	err = bh1750_sample_err;
+	seq = f->seen_seq + 1;
+	if (bh1750_sample_seq > BH1750_HIST &&
+	    seq <= bh1750_sample_seq - BH1750_HIST)
+		seq = bh1750_sample_seq - BH1750_HIST + 1;
+	for (; seq <= bh1750_sample_seq && n < max; seq++, n++) {
+		if (copy_to_user(buf + n * rec, bh1750_hist_at(seq), rec)) {
+			mutex_unlock(&bh1750_lock);
+			return n ? n * rec : -EFAULT;
+		}
+		f->seen_seq = seq;
+	}
+	mutex_unlock(&bh1750_lock);
+
+	// Không còn mẫu chưa đọc: báo lỗi bus, hoặc thiết bị đã bị gỡ
+	if (!n)
+		return err ? err : -EIO;
+	return n * rec;
+}
+
+/*
+ * ==== Hàm read() của file /dev/bh1750 ====
+ * Mặc định trả về "<raw> <age_ms> <milli_lux>\n": giá trị thô, tuổi của
+ * mẫu (ms) và độ rọi x1000 theo chế độ và MTreg lúc lấy mẫu;
+ * BH1750_IOC_SET_FORMAT chuyển sang bản ghi nhị phân (bh1750_uapi.h).
+ * Chỉ phải chờ mẫu đầu tiên sau khi mở; với O_NONBLOCK trả -EAGAIN.
+ */
 static ssize_t bh1750_read(struct file *file, char __user *buf, size_t count,
 						   loff_t *ppos)
 {
+	struct bh1750_file *f = file->private_data;
 	uint16_t lux;
-	char lux_str[16]; // buffer lưu chuỗi kết quả lux
-	int len;
+	u32 milli_lux;
+	u64 seq, age_ms;
+	char lux_str[48]; // buffer lưu chuỗi kết quả
+	int len, ret;
+
+	if (f->format == BH1750_FORMAT_BINARY)
+		return bh1750_read_binary(f, file, buf, count);
 
 	// Tránh đọc lặp lại cùng dữ liệu
 	if (*ppos > 0)
 		return 0;
 
-	// Đọc lux từ cảm biến
-	if (bh1750_read_lux(&lux) < 0)
+	if (!READ_ONCE(bh1750_sample_seq)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(bh1750_wq,
+					       READ_ONCE(bh1750_sample_seq) ||
+					       READ_ONCE(bh1750_sample_err) ||
+					       !READ_ONCE(bh1750_client));
+		if (ret)
+			return ret;
+	}
+
+	mutex_lock(&bh1750_lock);
+	seq = bh1750_sample_seq;
+	if (seq) {
+		lux = bh1750_hist_at(seq)->raw;
+		milli_lux = bh1750_hist_at(seq)->milli_lux;
+		age_ms = div_u64(ktime_get_ns() - bh1750_hist_at(seq)->timestamp_ns,
+				 NSEC_PER_MSEC);
+	}
+	mutex_unlock(&bh1750_lock);
+
+	// Chưa từng đọc được mẫu nào (lỗi bus hoặc thiết bị đã bị gỡ)
+	if (!seq)
 		return -EIO;
+	f->seen_seq = seq;
 
-	// Chuyển giá trị lux sang chuỗi
-	len = snprintf(lux_str, sizeof(lux_str), "%u\n", lux);
+	// Chuyển giá trị sang chuỗi
+	len = snprintf(lux_str, sizeof(lux_str), "%u %llu %u\n", lux, age_ms,
+		       milli_lux);
+	if (len > count)
+		return -EINVAL;
 
 	// Gửi dữ liệu từ kernel space -> user space
 	if (copy_to_user(buf, lux_str, len))
@@ -69,10 +380,163 @@ static ssize_t bh1750_read(struct file *file, char __user *buf, size_t count,
 	return len;
 }
 
+/*
+ * ==== Hàm poll() ====
+ * POLLIN khi có mẫu mới hơn mẫu file này đã đọc.
+ */
+static __poll_t bh1750_poll(struct file *file, poll_table *wait)
+{
+	struct bh1750_file *f = file->private_data;
+
+	poll_wait(file, &bh1750_wq, wait);
+
+	if (READ_ONCE(bh1750_sample_seq) != f->seen_seq)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+/* ==== Hàm ioctl(): chọn định dạng read() cho file này ==== */
+static long bh1750_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct bh1750_file *f = file->private_data;
+	u32 format;
+
+	switch (cmd) {
+	case BH1750_IOC_SET_FORMAT:
+		if (get_user(format, (u32 __user *)arg))
+			return -EFAULT;
+		if (format != BH1750_FORMAT_TEXT && format != BH1750_FORMAT_BINARY)
+			return -EINVAL;
+		f->format = format;
+		return 0;
+	case BH1750_IOC_GET_FORMAT:
+		return put_user(f->format, (u32 __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ * ==== Thuộc tính sysfs: /sys/class/bh1750_class/bh1750/ ====
+ *   mode:    cont_hres | cont_hres2 | cont_lres | one_hres | one_hres2 | one_lres
+ *   mtreg:   31..254 (mặc định 69), thời gian đo tỉ lệ theo MTreg
+ *   conv_ms: thời gian chuyển đổi hiện tại (chỉ đọc)
+ * Thay đổi có hiệu lực ngay cả khi đang đo.
+ */
+static int bh1750_reconfigure(unsigned int mode, unsigned int mtreg)
+{
+	unsigned int old_mode, old_mtreg, period;
+	int ret = 0;
+
+	mutex_lock(&bh1750_engine_lock);
+	mutex_lock(&bh1750_lock);
+	old_mode = bh1750_mode;
+	old_mtreg = bh1750_mtreg;
+	bh1750_mode = mode;
+	bh1750_mtreg = mtreg;
+	if (bh1750_users)
+		ret = bh1750_program();
+	if (ret) {
+		/*
+		 * ghi lỗi: giữ cấu hình cũ và thử nạp lại cho cảm biến khớp
+		 * với nó; nếu vẫn lỗi, lần đọc sau sẽ báo lỗi bus
+		 */
+		bh1750_mode = old_mode;
+		bh1750_mtreg = old_mtreg;
+		bh1750_program();
+	}
+	period = bh1750_conv_ms();
+	mutex_unlock(&bh1750_lock);
+
+	// Mẫu tiếp theo được đọc sau một lần chuyển đổi ở cấu hình mới
+	if (bh1750_users)
+		mod_delayed_work(system_wq, &bh1750_poll_work,
+				 msecs_to_jiffies(period));
+	mutex_unlock(&bh1750_engine_lock);
+	return ret;
+}
+
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr,
+			 char *buf)
+{
+	int len = 0;
+
+	// Chế độ đang dùng nằm trong ngoặc vuông
+	for (int i = 0; i < ARRAY_SIZE(bh1750_modes); i++)
+		len += sysfs_emit_at(buf, len,
+				     i == READ_ONCE(bh1750_mode) ? "[%s] " : "%s ",
+				     bh1750_modes[i].name);
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	int ret;
+
+	for (int i = 0; i < ARRAY_SIZE(bh1750_modes); i++) {
+		if (sysfs_streq(buf, bh1750_modes[i].name)) {
+			ret = bh1750_reconfigure(i, READ_ONCE(bh1750_mtreg));
+			return ret ? ret : count;
+		}
+	}
+	return -EINVAL;
+}
+static DEVICE_ATTR_RW(mode);
+
+static ssize_t mtreg_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	return sysfs_emit(buf, "%u\n", READ_ONCE(bh1750_mtreg));
+}
+
+static ssize_t mtreg_store(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	unsigned int mtreg;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &mtreg);
+	if (ret)
+		return ret;
+	if (mtreg < BH1750_MTREG_MIN || mtreg > BH1750_MTREG_MAX)
+		return -EINVAL;
+
+	ret = bh1750_reconfigure(READ_ONCE(bh1750_mode), mtreg);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(mtreg);
+
+static ssize_t conv_ms_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	unsigned int ms;
+
+	mutex_lock(&bh1750_lock);
+	ms = bh1750_conv_ms();
+	mutex_unlock(&bh1750_lock);
+	return sysfs_emit(buf, "%u\n", ms);
+}
+static DEVICE_ATTR_RO(conv_ms);
+
+static struct attribute *bh1750_attrs[] = {
+	&dev_attr_mode.attr,
+	&dev_attr_mtreg.attr,
+	&dev_attr_conv_ms.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(bh1750);
+
 /* ==== Định nghĩa file_operations cho character device ==== */
 static struct file_operations bh1750_fops = {
 	.owner = THIS_MODULE,
+	.open = bh1750_open,
 	.read = bh1750_read,
+	.poll = bh1750_poll,
+	.unlocked_ioctl = bh1750_ioctl,
+	.fasync = bh1750_fasync,
+	.release = bh1750_release,
 };
 
 /* ==== Hàm probe() - gọi khi kernel phát hiện thiết bị I2C tương thích ==== */
@@ -101,8 +565,9 @@ static int bh1750_probe(struct i2c_client *client)
 		goto del_cdev;
 	}
 
-	// Tạo thiết bị /dev/bh1750
-	device_create(bh1750_class, NULL, dev_num, NULL, "bh1750");
+	// Tạo thiết bị /dev/bh1750 kèm thuộc tính sysfs mode/mtreg/conv_ms
+	device_create_with_groups(bh1750_class, NULL, dev_num, NULL,
+				  bh1750_groups, "bh1750");
 
 	dev_info(&client->dev, "BH1750 character driver probed\n");
 	return 0;
@@ -117,6 +582,13 @@ unregister_region:
 /* ==== Hàm remove() - gọi khi thiết bị bị ngắt kết nối hoặc rút module ==== */
 static void bh1750_remove(struct i2c_client *client)
 {
+	// Dừng đọc định kỳ; file còn mở chỉ đọc được mẫu cũ
+	mutex_lock(&bh1750_lock);
+	bh1750_client = NULL;
+	mutex_unlock(&bh1750_lock);
+	cancel_delayed_work_sync(&bh1750_poll_work);
+	wake_up_interruptible(&bh1750_wq);
+
 	device_destroy(bh1750_class, dev_num); // Xoá /dev/bh1750
 	class_destroy(bh1750_class);		   // Xoá class
 	cdev_del(&bh1750_cdev);				   // Gỡ character device
@@ -0,0 +1,331 @@
+#include <linux/module.h>	 // Macro cho module kernel
+#include <linux/i2c.h>		 // Cấu trúc và API I2C trong kernel
+#include <linux/delay.h>	 // msleep
+#include <linux/mutex.h>	 // Khoá bảo vệ truy cập bus
+#include <linux/workqueue.h> // delayed_work: lấy mẫu định kỳ
+#include <linux/jiffies.h>
+#include <linux/math64.h>	 // div64_u64
+#include <linux/iio/iio.h>			   // Khung Industrial I/O
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+/*
+ * Driver IIO cho BH1750:
+ *   in_illuminance_raw / in_illuminance_scale (lux = raw * scale)
+ *   in_illuminance_sampling_frequency: tần số lấy mẫu của trigger riêng
+ *   buffer có timestamp, đọc bằng iio_readdev / libiio:
+ *
+ *   echo bh1750-dev0 > /sys/bus/iio/devices/iio:device0/trigger/current_trigger
+ *   iio_readdev -t bh1750-dev0 -s 100 bh1750 > samples.bin
+ */
+
+#define DRIVER_NAME "bh1750-iio"
+
+#define BH1750_CMD_POWER_DOWN 0x00
+#define BH1750_CMD_POWER_ON 0x01
+#define BH1750_CMD_CONT_HRES 0x10	   // Đo liên tục, độ phân giải cao
+#define BH1750_CMD_ONE_TIME_HRES 0x20 // Đo một lần rồi tự power down
+
+#define BH1750_CONV_MS 180 // Thời gian chuyển đổi tối đa ở H-res (datasheet)
+#define BH1750_DEFAULT_FREQ_HZ 5
+
+struct bh1750_iio {
+	struct i2c_client *client;
+	struct mutex lock;			  // Bảo vệ bus I2C và period_ms
+	struct iio_trigger *trig;	  // Trigger riêng, bắn theo period_ms
+	struct delayed_work poll_work; // Bắn trigger định kỳ
+	unsigned int period_ms;		  // Chu kỳ lấy mẫu của trigger
+	struct {
+		u16 raw;
+		s64 timestamp __aligned(8);
+	} scan; // Bản ghi đẩy vào buffer IIO
+};
+
+/* ==== Truy cập BH1750 qua I2C ==== */
+static int bh1750_iio_read_raw_value(struct bh1750_iio *data, u16 *raw)
+{
+	u8 buf[2];
+	int ret;
+
+	ret = i2c_master_recv(data->client, buf, 2);
+	if (ret < 0)
+		return ret;
+	if (ret != 2)
+		return -EIO;
+
+	*raw = (buf[0] << 8) | buf[1];
+	return 0;
+}
+
+// Đo một lần (dùng cho in_illuminance_raw khi không chạy buffer)
+static int bh1750_iio_one_shot(struct bh1750_iio *data, u16 *raw)
+{
+	int ret;
+
+	ret = i2c_smbus_write_byte(data->client, BH1750_CMD_ONE_TIME_HRES);
+	if (ret < 0)
+		return ret;
+
+	msleep(BH1750_CONV_MS);
+	return bh1750_iio_read_raw_value(data, raw);
+}
+
+/* ==== Buffer: đọc mẫu mới nhất khi trigger bắn ==== */
+static irqreturn_t bh1750_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bh1750_iio *data = iio_priv(indio_dev);
+	s64 ts = pf->timestamp;
+
+	/*
+	 * trigger riêng bắn bằng iio_trigger_poll_nested(), nửa trên
+	 * (iio_pollfunc_store_time) không chạy nên tự lấy timestamp.
+	 * Xoá sau khi dùng để lần sau không lấy lại giá trị cũ.
+	 */
+	pf->timestamp = 0;
+	if (!ts)
+		ts = iio_get_time_ns(indio_dev);
+
+	// Cảm biến đang ở chế độ liên tục, chỉ cần đọc 2 byte
+	mutex_lock(&data->lock);
+	if (!bh1750_iio_read_raw_value(data, &data->scan.raw))
+		iio_push_to_buffers_with_timestamp(indio_dev, &data->scan, ts);
+	mutex_unlock(&data->lock);
+
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+// Bật chế độ đo liên tục trước khi buffer chạy (với bất kỳ trigger nào)
+static int bh1750_iio_buffer_preenable(struct iio_dev *indio_dev)
+{
+	struct bh1750_iio *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->lock);
+	ret = i2c_smbus_write_byte(data->client, BH1750_CMD_CONT_HRES);
+	mutex_unlock(&data->lock);
+
+	return ret < 0 ? ret : 0;
+}
+
+static int bh1750_iio_buffer_postdisable(struct iio_dev *indio_dev)
+{
+	struct bh1750_iio *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->lock);
+	ret = i2c_smbus_write_byte(data->client, BH1750_CMD_POWER_DOWN);
+	mutex_unlock(&data->lock);
+
+	return ret < 0 ? ret : 0;
+}
+
+static const struct iio_buffer_setup_ops bh1750_iio_buffer_ops = {
+	.preenable = bh1750_iio_buffer_preenable,
+	.postdisable = bh1750_iio_buffer_postdisable,
+};
+
+/* ==== Trigger riêng: delayed_work bắn trigger theo period_ms ==== */
+static void bh1750_iio_poll_work(struct work_struct *work)
+{
+	struct bh1750_iio *data =
+		container_of(work, struct bh1750_iio, poll_work.work);
+
+	iio_trigger_poll_nested(data->trig);
+	schedule_delayed_work(&data->poll_work,
+			      msecs_to_jiffies(READ_ONCE(data->period_ms)));
+}
+
+static int bh1750_iio_set_trigger_state(struct iio_trigger *trig, bool state)
+{
+	struct bh1750_iio *data = iio_trigger_get_drvdata(trig);
+
+	if (state)
+		// Mẫu đầu tiên sau một lần chuyển đổi
+		schedule_delayed_work(&data->poll_work,
+				      msecs_to_jiffies(BH1750_CONV_MS));
+	else
+		cancel_delayed_work_sync(&data->poll_work);
+	return 0;
+}
+
+static const struct iio_trigger_ops bh1750_iio_trigger_ops = {
+	.set_trigger_state = bh1750_iio_set_trigger_state,
+};
+
+/* ==== Thuộc tính IIO ==== */
+static int bh1750_iio_read(struct iio_dev *indio_dev,
+			   struct iio_chan_spec const *chan, int *val,
+			   int *val2, long mask)
+{
+	struct bh1750_iio *data = iio_priv(indio_dev);
+	u16 raw;
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+
+		mutex_lock(&data->lock);
+		ret = bh1750_iio_one_shot(data, &raw);
+		mutex_unlock(&data->lock);
+
+		iio_device_release_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+		*val = raw;
+		return IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SCALE:
+		// Theo datasheet: lux = raw / 1.2
+		*val = 0;
+		*val2 = 833333;
+		return IIO_VAL_INT_PLUS_MICRO;
+
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = 1000;
+		*val2 = READ_ONCE(data->period_ms);
+		return IIO_VAL_FRACTIONAL;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static int bh1750_iio_write(struct iio_dev *indio_dev,
+			    struct iio_chan_spec const *chan, int val, int val2,
+			    long mask)
+{
+	struct bh1750_iio *data = iio_priv(indio_dev);
+	u64 freq_uhz;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		if (val < 0 || val2 < 0)
+			return -EINVAL;
+		freq_uhz = (u64)val * 1000000 + val2;
+		if (!freq_uhz)
+			return -EINVAL;
+
+		// Không lấy mẫu nhanh hơn một lần chuyển đổi
+		if (div64_u64(1000000000ULL, freq_uhz) < BH1750_CONV_MS)
+			return -EINVAL;
+
+		WRITE_ONCE(data->period_ms,
+			   div64_u64(1000000000ULL, freq_uhz));
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info bh1750_iio_info = {
+	.read_raw = bh1750_iio_read,
+	.write_raw = bh1750_iio_write,
+};
+
+static const struct iio_chan_spec bh1750_iio_channels[] = {
+	{
+		.type = IIO_LIGHT,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |
+				      BIT(IIO_CHAN_INFO_SCALE) |
+				      BIT(IIO_CHAN_INFO_SAMP_FREQ),
+		.scan_index = 0,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_CPU,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(1),
+};
+
+/* ==== Hàm probe() ==== */
+static int bh1750_iio_probe(struct i2c_client *client)
+{
+	struct device *dev = &client->dev;
+	struct iio_dev *indio_dev;
+	struct bh1750_iio *data;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(dev, sizeof(*data));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	data = iio_priv(indio_dev);
+	data->client = client;
+	data->period_ms = 1000 / BH1750_DEFAULT_FREQ_HZ;
+	mutex_init(&data->lock);
+	INIT_DELAYED_WORK(&data->poll_work, bh1750_iio_poll_work);
+
+	// Kiểm tra cảm biến có trả lời không
+	ret = i2c_smbus_write_byte(client, BH1750_CMD_POWER_DOWN);
+	if (ret < 0)
+		return dev_err_probe(dev, ret, "BH1750 không phản hồi\n");
+
+	indio_dev->name = "bh1750";
+	indio_dev->info = &bh1750_iio_info;
+	indio_dev->channels = bh1750_iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(bh1750_iio_channels);
+	indio_dev->modes = INDIO_DIRECT_MODE;
+
+	data->trig = devm_iio_trigger_alloc(dev, "%s-dev%d", indio_dev->name,
+					    iio_device_id(indio_dev));
+	if (!data->trig)
+		return -ENOMEM;
+	data->trig->ops = &bh1750_iio_trigger_ops;
+	iio_trigger_set_drvdata(data->trig, data);
+
+	ret = devm_iio_trigger_register(dev, data->trig);
+	if (ret)
+		return ret;
+
+	// Buffer kfifo, timestamp lấy ở nửa trên của trigger
+	ret = devm_iio_triggered_buffer_setup(dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      bh1750_iio_trigger_handler,
+					      &bh1750_iio_buffer_ops);
+	if (ret)
+		return ret;
+
+	ret = devm_iio_device_register(dev, indio_dev);
+	if (ret)
+		return ret;
+
+	dev_info(dev, "BH1750 IIO driver probed\n");
+	return 0;
+}
+
+/* ==== Bảng ID ==== */
+static const struct i2c_device_id bh1750_iio_id[] = {
+	{"bh1750", 0},
+	{}};
+MODULE_DEVICE_TABLE(i2c, bh1750_iio_id);
+
+static const struct of_device_id bh1750_iio_of_match[] = {
+	{.compatible = "rohm,bh1750"},
+	{}};
+MODULE_DEVICE_TABLE(of, bh1750_iio_of_match);
+
+static struct i2c_driver bh1750_iio_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.of_match_table = bh1750_iio_of_match,
+	},
+	.probe = bh1750_iio_probe,
+	.id_table = bh1750_iio_id,
+};
+
+module_i2c_driver(bh1750_iio_driver);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("ABC");
+MODULE_DESCRIPTION("IIO driver cho BH1750 trên Raspberry Pi");
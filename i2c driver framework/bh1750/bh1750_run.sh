@@ -9,12 +9,14 @@ if [ ! -e "$DEVICE" ]; then
 fi
 
 while true; do
-    RAW=$(cat "$DEVICE" 2>/dev/null)
-    
+    # Driver trả về "<raw> <age_ms> <milli_lux>": độ rọi đã tính trong
+    # kernel theo chế độ và MTreg, không cần bc
+    read -r RAW AGE MLUX < <(cat "$DEVICE" 2>/dev/null)
+
     # Kiểm tra nếu dữ liệu là số
-    if [[ "$RAW" =~ ^[0-9]+$ ]]; then
-        LUX=$(echo "scale=2; $RAW / 1.2" | bc)
-        echo "Lux = $LUX"
+    if [[ "$MLUX" =~ ^[0-9]+$ ]]; then
+        printf 'Lux = %d.%03d (raw %s, mẫu cách đây %s ms)\n' \
+            $((MLUX / 1000)) $((MLUX % 1000)) "$RAW" "$AGE"
     else
         echo "Không nhận được dữ liệu hợp lệ: $RAW"
     fi
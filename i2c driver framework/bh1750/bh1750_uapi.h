@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * bh1750_uapi.h - giao diện userspace của /dev/bh1750
+ */
+#ifndef _BH1750_UAPI_H
+#define _BH1750_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ==== Định dạng read() ====
+ * BH1750_FORMAT_TEXT (mặc định): "<raw> <age_ms> <milli_lux>\n" của mẫu
+ * mới nhất, milli_lux như trong struct bh1750_sample.
+ * BH1750_FORMAT_BINARY: mảng struct bh1750_sample, cũ trước mới sau,
+ * gồm mọi mẫu file chưa đọc (tối đa count / sizeof(struct bh1750_sample)).
+ * Định dạng là của riêng từng file đang mở.
+ */
+enum bh1750_format {
+	BH1750_FORMAT_TEXT = 0,
+	BH1750_FORMAT_BINARY = 1,
+};
+
+struct bh1750_sample {
+	__u64 seq;	    // Số thứ tự mẫu, bị nhảy nghĩa là đã mất mẫu
+	__u64 timestamp_ns; // Thời điểm đọc mẫu (CLOCK_MONOTONIC)
+	__u32 milli_lux;    // Độ rọi x1000, đã tính theo chế độ và MTreg
+	__u16 raw;	    // Giá trị thô từ cảm biến
+	__u8 mode;	    // Chế độ đo lúc lấy mẫu (thứ tự như sysfs mode)
+	__u8 mtreg;	    // MTreg lúc lấy mẫu
+};
+
+#define BH1750_IOC_MAGIC 'b'
+
+#define BH1750_IOC_SET_FORMAT _IOW(BH1750_IOC_MAGIC, 1, __u32)
+#define BH1750_IOC_GET_FORMAT _IOR(BH1750_IOC_MAGIC, 2, __u32)
+
+#endif /* _BH1750_UAPI_H */
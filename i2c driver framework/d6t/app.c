@@ -1,89 +1,409 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
+#include "libd6t/libd6t.h"
 
-#define DEVICE_NAME "/dev/d6t"
-#define PIXEL_COUNT 1024
-#define RAW_SIZE (PIXEL_COUNT + 1) // 1 PTAT + 1024 pixel
+/*
+ * Build: gcc -O2 -o app app.c libd6t/libd6t.c
+ * Chạy:  ./app [0|1] [--fps GIÂY] [--synthetic] [--device PATH]
+ *   0: in số có màu, 1 (mặc định): in ô vuông màu
+ *   --fps GIÂY: chạy GIÂY giây rồi in frame/s, thời gian vẽ và số byte
+ *               mỗi frame ra stderr
+ *   --synthetic: không cần cảm biến, tự sinh cảnh 32x32 để đo riêng
+ *                phần vẽ
+ *
+ * Mỗi frame được dựng trong một buffer cấp phát sẵn và ghi ra bằng một
+ * lần write(). Chỉ những ô đổi màu (chế độ 1) hoặc đổi giá trị (chế độ
+ * 0) mới được vẽ lại.
+ */
 
-#define D6T_IOC_MAGIC 'x'
-#define D6T_IOC_READ_RAW _IOR(D6T_IOC_MAGIC, 1, uint16_t *)
+#define DEVICE_NAME "/dev/d6t0"
+#define MODEL_NAME "d6t32l01a" // Cho d6t_full khi chưa init
+
+#define SYN_ROW 32
+#define SYN_COL 32
 
 // ANSI Color Codes
-#define RESET   "\033[0m"
-#define PURPLE  "\033[35m"
-#define BLUE    "\033[34m"
-#define CYAN    "\033[36m"
-#define GREEN   "\033[32m"
-#define YELLOW  "\033[33m"
-#define ORANGE  "\033[91m"
-#define RED     "\033[31m"
-
-// Hàm lấy màu theo nhiệt độ
-const char* get_color(float t) {
-    if (t < 20)       return PURPLE;
-    else if (t < 25)  return BLUE;
-    else if (t < 30)  return CYAN;
-    else if (t < 35)  return GREEN;
-    else if (t < 40)  return YELLOW;
-    else if (t < 45)  return ORANGE;
-    else              return RED;
+#define RESET "\033[0m"
+
+enum { PURPLE, BLUE, CYAN, GREEN, YELLOW, ORANGE, RED, N_COLORS };
+
+static const char *const color_esc[N_COLORS] = {
+    [PURPLE] = "\033[35m",
+    [BLUE] = "\033[34m",
+    [CYAN] = "\033[36m",
+    [GREEN] = "\033[32m",
+    [YELLOW] = "\033[33m",
+    [ORANGE] = "\033[91m",
+    [RED] = "\033[31m",
+};
+
+// Ngưỡng màu theo 0.1 °C: dưới 20 °C tím, ..., từ 45 °C trở lên đỏ
+static const int16_t color_limit[N_COLORS - 1] = { 200, 250, 300, 350, 400, 450 };
+
+#define LUT_MIN 199 // mọi giá trị thấp hơn đều cùng màu với 199
+#define LUT_MAX 450 // mọi giá trị cao hơn đều cùng màu với 450
+static uint8_t color_lut[LUT_MAX - LUT_MIN + 1];
+
+static void build_color_lut(void)
+{
+    for (int v = LUT_MIN; v <= LUT_MAX; v++) {
+        int c = 0;
+
+        while (c < N_COLORS - 1 && v >= color_limit[c])
+            c++;
+        color_lut[v - LUT_MIN] = c;
+    }
 }
 
-int main(int argc, char *argv[])
+// Thay cho chuỗi if của get_color(): một lần tra bảng mỗi ô
+static inline uint8_t color_of(int v)
 {
-    int mode = 1; // mặc định là in ô vuông
-    if (argc > 1) {
-        mode = atoi(argv[1]); // ./program 0 hoặc ./program 1
+    if (v < LUT_MIN)
+        v = LUT_MIN;
+    else if (v > LUT_MAX)
+        v = LUT_MAX;
+    return color_lut[v - LUT_MIN];
+}
+
+/* ================ RENDERER ================ */
+struct renderer {
+    int mode; // 0: số, 1: ô vuông
+    int row, col;
+    int cell_w; // số cột màn hình của một ô, cả khoảng trắng
+    char *buf; // một frame đã mã hoá ANSI
+    char *p; // vị trí ghi tiếp theo trong buf
+    int32_t *shown; // thứ đang hiện ở mỗi ô: màu (mode 1) hoặc 0.1 °C (mode 0)
+    int32_t shown_ptat;
+    int cur_r, cur_c; // vị trí con trỏ sau lần ghi cuối
+    int cur_color; // màu đang bật trên terminal, -1 nếu không rõ
+};
+
+#define NOT_SHOWN INT32_MIN
+
+static char *put_str(char *p, const char *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+static char *put_uint(char *p, unsigned int v)
+{
+    char tmp[10];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// Như printf("%4.1f", v / 10.0) với v tính bằng 0.1 °C
+static char *put_deci(char *p, int v)
+{
+    unsigned int u = v < 0 ? -v : v;
+    char tmp[8];
+    int n = 0;
+
+    tmp[n++] = '0' + u % 10;
+    tmp[n++] = '.';
+    u /= 10;
+    do {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        tmp[n++] = '-';
+    while (n < 4)
+        tmp[n++] = ' ';
+    while (n)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// Chỉ di chuyển con trỏ khi ô không nằm ngay sau ô vừa vẽ
+static void move_to(struct renderer *r, int row, int col)
+{
+    if (r->cur_r == row && r->cur_c == col)
+        return;
+    r->p = put_str(r->p, "\033[");
+    r->p = put_uint(r->p, row);
+    *r->p++ = ';';
+    r->p = put_uint(r->p, col);
+    *r->p++ = 'H';
+    r->cur_r = row;
+    r->cur_c = col;
+}
+
+static void set_color(struct renderer *r, int color)
+{
+    if (r->cur_color == color)
+        return;
+    r->p = put_str(r->p, color < 0 ? RESET : color_esc[color]);
+    r->cur_color = color;
+}
+
+static int renderer_init(struct renderer *r, int mode, int row, int col)
+{
+    size_t n = (size_t)row * col;
+
+    memset(r, 0, sizeof(*r));
+    r->mode = mode;
+    r->row = row;
+    r->col = col;
+    r->cell_w = mode ? 3 : 5; // "██ " hoặc "25.3 "
+    // Ô xấu nhất: di chuyển con trỏ + màu + "-100.0 "
+    r->buf = malloc(n * 32 + 256);
+    r->shown = malloc(n * sizeof(*r->shown));
+    if (!r->buf || !r->shown)
+        return -ENOMEM;
+    for (size_t i = 0; i < n; i++)
+        r->shown[i] = NOT_SHOWN;
+    r->shown_ptat = NOT_SHOWN;
+    r->cur_r = -1;
+    r->cur_color = -1;
+
+    // Frame đầu: xoá màn hình, ẩn con trỏ, kẻ dòng cuối
+    r->p = put_str(r->buf, "\033[2J\033[?25l");
+    move_to(r, row + 2, 1);
+    for (int i = 0; i < col * r->cell_w; i++)
+        *r->p++ = '-';
+    r->cur_r = -1;
+    return 0;
+}
+
+static void renderer_free(struct renderer *r)
+{
+    free(r->buf);
+    free(r->shown);
+}
+
+// Dựng phần thay đổi của frame vào r->buf, trả về số byte cần ghi
+static size_t render_frame(struct renderer *r, const uint16_t *data)
+{
+    const int16_t *v = (const int16_t *)data; // 0.1 °C có dấu
+    int32_t *shown = r->shown;
+
+    if (r->p == NULL)
+        r->p = r->buf;
+
+    if (v[0] != r->shown_ptat) {
+        r->shown_ptat = v[0];
+        move_to(r, 1, 1);
+        set_color(r, -1);
+        r->p = put_str(r->p, "PTAT = ");
+        r->p = put_deci(r->p, v[0]);
+        r->p = put_str(r->p, " [*C]  ");
+        r->cur_r = -1;
     }
 
-    int fd = open(DEVICE_NAME, O_RDWR);
-    if (fd < 0) {
-        perror("open");
-        return 1;
+    for (int row = 0; row < r->row; row++) {
+        for (int col = 0; col < r->col; col++) {
+            int t = v[1 + row * r->col + col];
+            int color = color_of(t);
+            int32_t key = r->mode ? color : t;
+            char *start;
+
+            if (*shown++ == key)
+                continue;
+            shown[-1] = key;
+
+            move_to(r, row + 2, 1 + col * r->cell_w);
+            set_color(r, color);
+            start = r->p;
+            if (r->mode)
+                r->p = put_str(r->p, "██ ");
+            else
+                r->p = put_str(put_deci(r->p, t), " ");
+            // "██" là 6 byte nhưng chỉ 2 cột
+            r->cur_c += r->mode ? 3 : r->p - start;
+        }
+    }
+
+    size_t len = r->p - r->buf;
+    r->p = NULL;
+    return len;
+}
+
+static int write_all(int fd, const char *p, size_t n)
+{
+    while (n) {
+        ssize_t w = write(fd, p, n);
+
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* ================ NGUỒN FRAME ================ */
+// Cảnh giả: nền 23 °C và một vật nóng nảy qua lại
+static void synthetic_frame(uint16_t *data, unsigned long t)
+{
+    int cx = 4 + abs((int)(t % 48) - 24);
+    int cy = 4 + abs((int)((t / 2 + 12) % 48) - 24);
+
+    data[0] = 250;
+    for (int y = 0; y < SYN_ROW; y++) {
+        for (int x = 0; x < SYN_COL; x++) {
+            int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            int v = 230 + (d2 < 50 ? 250 - d2 * 5 : 0);
+
+            data[1 + y * SYN_COL + x] = (uint16_t)v;
+        }
     }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-    uint16_t raw_buf[RAW_SIZE];
+static volatile sig_atomic_t stop;
 
-    // Clear screen
-    printf("\033[2J\033[H");
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
 
-    while (1) {
-        if (ioctl(fd, D6T_IOC_READ_RAW, raw_buf) < 0) {
-            perror("ioctl");
+int main(int argc, char *argv[])
+{
+    static const struct option opts[] = {
+        { "fps", required_argument, NULL, 'f' },
+        { "synthetic", no_argument, NULL, 's' },
+        { "device", required_argument, NULL, 'd' },
+        { 0 }
+    };
+    const char *device = DEVICE_NAME;
+    int mode = 1; // mặc định là in ô vuông
+    double fps_sec = 0; // > 0: chế độ đo
+    int synthetic = 0;
+    int opt, ret = 0;
+
+    while ((opt = getopt_long(argc, argv, "f:sd:", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            fps_sec = atof(optarg);
             break;
+        case 's':
+            synthetic = 1;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [0|1] [--fps SEC] [--synthetic] "
+                            "[--device PATH]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        mode = atoi(argv[optind]) ? 1 : 0; // ./program 0 hoặc ./program 1
+
+    struct d6t_dev *dev = NULL;
+    uint16_t *syn = NULL;
+    int row = SYN_ROW, col = SYN_COL;
+
+    if (synthetic) {
+        syn = malloc((1 + SYN_ROW * SYN_COL) * sizeof(*syn));
+        if (!syn)
+            return 1;
+    } else {
+        dev = d6t_open(device, MODEL_NAME);
+        if (!dev) {
+            perror("d6t_open");
+            return 1;
         }
+        row = d6t_info(dev)->row;
+        col = d6t_info(dev)->col;
+    }
 
-        // Cursor top-left
-        printf("\033[H");
+    struct renderer r;
+    if (renderer_init(&r, mode, row, col)) {
+        fprintf(stderr, "out of memory\n");
+        d6t_close(dev);
+        free(syn);
+        return 1;
+    }
+    build_color_lut();
 
-        printf("PTAT = %3.1f [*C]\n", raw_buf[0] / 10.0);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
 
-        for (int row = 0; row < 32; row++) {
-            for (int col = 0; col < 32; col++) {
-                float t = raw_buf[1 + row * 32 + col] / 10.0;
-                const char *color = get_color(t);
+    uint64_t start = now_ns(), render_ns = 0, bytes = 0;
+    unsigned long frames = 0;
 
-                if (mode == 0) {
-                    // In số có màu
-                    printf("%s%4.1f%s ", color, t, RESET);
-                } else {
-                    // In ô vuông màu
-                    printf("%s██%s ", color, RESET);
+    while (!stop) {
+        const uint16_t *data;
+
+        if (synthetic) {
+            synthetic_frame(syn, frames);
+            data = syn;
+        } else {
+            struct d6t_frame frame;
+
+            // Ngủ tới khi driver có frame mới
+            ret = d6t_next_frame(dev, &frame, 1000);
+            if (ret == -ETIMEDOUT)
+                continue; // timeout, chưa có frame mới
+            if (ret < 0) {
+                if (ret != -EINTR) {
+                    errno = -ret;
+                    perror("d6t_next_frame");
                 }
+                break;
             }
-            printf("\n");
+            data = frame.data;
         }
 
-        printf("-------------------------\n");
+        uint64_t t0 = now_ns();
+        size_t len = render_frame(&r, data);
+        if (write_all(STDOUT_FILENO, r.buf, len)) {
+            ret = -errno;
+            break;
+        }
+        render_ns += now_ns() - t0;
+        bytes += len;
+        frames++;
 
-        fflush(stdout);
-        usleep(400000);
+        if (fps_sec > 0 && (now_ns() - start) / 1e9 >= fps_sec)
+            break;
     }
 
-    close(fd);
-    return 0;
-}
\ No newline at end of file
+    // Trả lại terminal: bỏ màu, hiện con trỏ, xuống dưới bảng
+    dprintf(STDOUT_FILENO, RESET "\033[?25h\033[%d;1H\n", row + 3);
+
+    if (fps_sec > 0 && frames) {
+        double sec = (now_ns() - start) / 1e9;
+
+        fprintf(stderr, "source=%s frames=%lu fps=%.1f render_us=%.1f "
+                        "bytes_per_frame=%.0f\n",
+                synthetic ? "synthetic" : d6t_access_name(dev), frames,
+                frames / sec, render_ns / 1e3 / frames,
+                (double)bytes / frames);
+    }
+
+    renderer_free(&r);
+    d6t_close(dev);
+    free(syn);
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * crc_bench.c - cycles per frame of the D6T PEC check
+ *
+ * Compares the old bit-at-a-time CRC-8 loop with the byte table and the
+ * slicing-by-8 path of d6t_crc.h over one d6t32l01a frame
+ * (address byte + 2051 bytes, PEC excluded).
+ *
+ * Build: gcc -O2 -o crc_bench crc_bench.c
+ * Run:   ./crc_bench [iterations]
+ *
+ * On x86 the unit is TSC cycles, elsewhere nanoseconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../d6t_crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+static inline uint64_t now(void)
+{
+    return __rdtsc();
+}
+#else
+#define UNIT "ns"
+static inline uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+#define N_READ (2 * (1 + 32 * 32) + 1) // PTAT + 1024 pixel + PEC
+#define I2C_ADDR 0x0A
+
+// Phiên bản cũ trong d6tioctl.c / d6t_full.c: từng bit một
+static uint8_t crc8_bitwise_byte(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (int i = 0; i < 8; i++) {
+        if (crc & 0x80)
+            crc = (crc << 1) ^ 0x07;
+        else
+            crc <<= 1;
+    }
+    return crc;
+}
+
+static uint8_t pec_bitwise(const uint8_t *buf, size_t n)
+{
+    uint8_t crc = crc8_bitwise_byte(0, (I2C_ADDR << 1) | 1);
+
+    for (size_t i = 0; i < n; i++)
+        crc = crc8_bitwise_byte(crc, buf[i]);
+    return crc;
+}
+
+static uint8_t pec_table(const uint8_t *buf, size_t n)
+{
+    uint8_t crc = d6t_crc8_byte(0, (I2C_ADDR << 1) | 1);
+
+    for (size_t i = 0; i < n; i++)
+        crc = d6t_crc8_byte(crc, buf[i]);
+    return crc;
+}
+
+static uint8_t pec_sliced(const uint8_t *buf, size_t n)
+{
+    uint8_t crc = d6t_crc8_byte(0, (I2C_ADDR << 1) | 1);
+
+    return d6t_crc8(crc, buf, n);
+}
+
+struct variant {
+    const char *name;
+    uint8_t (*fn)(const uint8_t *, size_t);
+};
+
+static const struct variant variants[] = {
+    { "bitwise (before)", pec_bitwise },
+    { "table", pec_table },
+    { "slicing-by-8", pec_sliced },
+};
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+    uint8_t buf[N_READ];
+    uint8_t expect;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = rand();
+
+    expect = pec_bitwise(buf, N_READ - 1);
+
+    printf("%-18s %12s %12s\n", "variant", "min " UNIT, "avg " UNIT);
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        uint64_t best = UINT64_MAX, total = 0;
+        volatile uint8_t crc = 0;
+
+        for (int it = 0; it < iterations; it++) {
+            uint64_t t = now();
+
+            crc = variants[v].fn(buf, N_READ - 1);
+            t = now() - t;
+            total += t;
+            if (t < best)
+                best = t;
+        }
+
+        if (crc != expect) {
+            fprintf(stderr, "%s: CRC mismatch %02X != %02X\n",
+                    variants[v].name, crc, expect);
+            return 1;
+        }
+        printf("%-18s %12llu %12llu\n", variants[v].name,
+               (unsigned long long)best,
+               (unsigned long long)(total / iterations));
+    }
+    return 0;
+}
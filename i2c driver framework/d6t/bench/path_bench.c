@@ -0,0 +1,420 @@
+/*
+ * path_bench.c - frames/s, latency, CPU and syscalls of one access path
+ *
+ * Paths:
+ *   d6t-text       read() in D6T_FORMAT_TEXT (d6t32l)
+ *   d6t-raw        read() in D6T_FORMAT_RAW (d6t32l, d6t_full)
+ *   d6t-ioctl      D6T_IOC_READ_RAW (d6tioctl)
+ *   d6t-frames     poll() + D6T_IOC_READ_FRAMES (d6tioctl, acquire=1)
+ *   d6t-ring       poll() + mmap ring (d6t_full)
+ *   bh1750-text    read() of "<raw> <age_ms> <milli_lux>"
+ *   bh1750-binary  read() of struct bh1750_sample records
+ *
+ * Build: gcc -O2 -o path_bench path_bench.c
+ * Run:   ./path_bench -p d6t-raw -d /dev/D6T0 [-n frames] [-l label]
+ *
+ * Prints one JSON object per run. Latency is the time of one acquisition
+ * step (poll included), CPU time is user + system time of this process
+ * only, syscalls are the ones this tool issues per step. Kernel threads
+ * of the driver (acquisition, ring producer) are not counted.
+ * run_paths.sh runs every path against d6t_stub.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "../d6t_uapi.h"
+#include "../../bh1750/bh1750_uapi.h"
+
+#define TEXT_MAX 16384 // 1025 values as text fit easily
+#define BATCH 16 // Frames / samples per call on the batched paths
+#define MAX_ERRORS 100 // Failed steps in a row before giving up
+
+struct bench {
+    int fd;
+    uint32_t n_raw; // d6t values per frame
+    void *buf;
+    struct d6t_frame_info finfo[BATCH];
+    unsigned long syscalls;
+    unsigned long errors;
+    size_t bytes; // Bytes handed to userspace per frame
+
+    // d6t-ring
+    void *map;
+    size_t map_len;
+    struct d6t_ring_hdr *hdr;
+    uint64_t next;
+    uint64_t sink; // Keeps the ring reads from being optimised out
+};
+
+struct path {
+    const char *name;
+    int (*setup)(struct bench *b);
+    int (*step)(struct bench *b); // Frames obtained, or -errno
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int wait_in(struct bench *b)
+{
+    struct pollfd pfd = { .fd = b->fd, .events = POLLIN };
+
+    b->syscalls++;
+    if (poll(&pfd, 1, 5000) <= 0)
+        return -ETIMEDOUT;
+    return 0;
+}
+
+/* ================ D6T ================ */
+static int d6t_setup(struct bench *b, uint32_t format)
+{
+    struct d6t_dev_info info;
+    char model[D6T_MODEL_NAME_MAX] = "d6t32l01a";
+
+    if (ioctl(b->fd, D6T_IOC_GET_INFO, &info) < 0)
+        return -errno;
+    // d6t_full waits for the model from userspace
+    if (!info.n_raw_data &&
+        (ioctl(b->fd, D6T_IOC_INIT, model) < 0 ||
+         ioctl(b->fd, D6T_IOC_GET_INFO, &info) < 0))
+        return -errno;
+    b->n_raw = info.n_raw_data;
+
+    if (format != (uint32_t)-1 &&
+        ioctl(b->fd, D6T_IOC_SET_FORMAT, &format) < 0)
+        return -errno;
+
+    b->buf = malloc(TEXT_MAX + (size_t)BATCH * b->n_raw * sizeof(uint16_t));
+    return b->buf ? 0 : -ENOMEM;
+}
+
+static int d6t_text_setup(struct bench *b)
+{
+    return d6t_setup(b, D6T_FORMAT_TEXT);
+}
+
+static int d6t_raw_setup(struct bench *b)
+{
+    return d6t_setup(b, D6T_FORMAT_RAW);
+}
+
+static int d6t_plain_setup(struct bench *b)
+{
+    return d6t_setup(b, (uint32_t)-1);
+}
+
+static int d6t_text_step(struct bench *b)
+{
+    ssize_t n;
+
+    b->syscalls++;
+    n = pread(b->fd, b->buf, TEXT_MAX, 0);
+    if (n < 0)
+        return -errno;
+    b->bytes = n;
+    return 1;
+}
+
+static int d6t_raw_step(struct bench *b)
+{
+    size_t len = b->n_raw * sizeof(uint16_t);
+    ssize_t n;
+
+    b->syscalls++;
+    n = pread(b->fd, b->buf, len, 0);
+    if (n < 0)
+        return -errno;
+    if ((size_t)n != len)
+        return -EIO;
+    b->bytes = len;
+    return 1;
+}
+
+static int d6t_ioctl_step(struct bench *b)
+{
+    b->syscalls++;
+    if (ioctl(b->fd, D6T_IOC_READ_RAW, b->buf) < 0)
+        return -errno;
+    b->bytes = b->n_raw * sizeof(uint16_t);
+    return 1;
+}
+
+static int d6t_frames_step(struct bench *b)
+{
+    struct d6t_read_frames req = {
+        .version = D6T_FRAMES_VERSION,
+        .max_frames = BATCH,
+        .n_raw_data = b->n_raw,
+        .info_ptr = (uintptr_t)b->finfo,
+        .data_ptr = (uintptr_t)b->buf,
+    };
+    int ret;
+
+    ret = wait_in(b);
+    if (ret)
+        return ret;
+    b->syscalls++;
+    if (ioctl(b->fd, D6T_IOC_READ_FRAMES, &req) < 0)
+        return -errno;
+    b->bytes = b->n_raw * sizeof(uint16_t);
+    return req.n_frames;
+}
+
+static int d6t_ring_setup(struct bench *b)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct d6t_ring_hdr *hdr;
+    int ret;
+
+    ret = d6t_setup(b, (uint32_t)-1);
+    if (ret)
+        return ret;
+
+    hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, b->fd, 0);
+    if (hdr == MAP_FAILED)
+        return -errno;
+    b->map_len = hdr->data_offset + (size_t)hdr->depth * hdr->slot_size;
+    b->map_len = (b->map_len + page - 1) / page * page;
+    munmap(hdr, page);
+
+    b->map = mmap(NULL, b->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  b->fd, 0);
+    if (b->map == MAP_FAILED)
+        return -errno;
+    b->hdr = b->map;
+    b->next = __atomic_load_n(&b->hdr->head, __ATOMIC_ACQUIRE) + 1;
+    return 0;
+}
+
+// Every frame published since the last step, touched in place
+static int d6t_ring_step(struct bench *b)
+{
+    struct d6t_ring_hdr *hdr = b->hdr;
+    uint64_t head;
+    int n = 0, ret;
+
+    __atomic_store_n(&hdr->tail, b->next, __ATOMIC_RELEASE);
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (head < b->next) {
+        ret = wait_in(b);
+        if (ret)
+            return ret;
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    }
+    if (head >= b->next + hdr->depth)
+        b->next = head - hdr->depth + 1;
+
+    for (; b->next <= head; b->next++) {
+        const struct d6t_frame_hdr *fh = (const void *)
+            ((char *)b->map + hdr->data_offset +
+             (b->next - 1) % hdr->depth * hdr->slot_size);
+        const uint16_t *data = (const uint16_t *)(fh + 1);
+
+        if (__atomic_load_n(&fh->seq, __ATOMIC_ACQUIRE) != b->next)
+            continue;
+        for (uint32_t i = 0; i < b->n_raw; i++)
+            b->sink += data[i];
+        n++;
+    }
+    b->bytes = 0; // Nothing is copied
+    return n;
+}
+
+/* ================ BH1750 ================ */
+static int bh1750_setup(struct bench *b, uint32_t format)
+{
+    if (ioctl(b->fd, BH1750_IOC_SET_FORMAT, &format) < 0)
+        return -errno;
+    b->buf = malloc(BATCH * sizeof(struct bh1750_sample));
+    return b->buf ? 0 : -ENOMEM;
+}
+
+static int bh1750_text_setup(struct bench *b)
+{
+    return bh1750_setup(b, BH1750_FORMAT_TEXT);
+}
+
+static int bh1750_binary_setup(struct bench *b)
+{
+    return bh1750_setup(b, BH1750_FORMAT_BINARY);
+}
+
+static int bh1750_text_step(struct bench *b)
+{
+    ssize_t n;
+
+    b->syscalls++;
+    n = pread(b->fd, b->buf, 64, 0);
+    if (n < 0)
+        return -errno;
+    b->bytes = n;
+    return 1;
+}
+
+static int bh1750_binary_step(struct bench *b)
+{
+    ssize_t n;
+
+    b->syscalls++;
+    n = read(b->fd, b->buf, BATCH * sizeof(struct bh1750_sample));
+    if (n < 0)
+        return -errno;
+    b->bytes = sizeof(struct bh1750_sample);
+    return n / sizeof(struct bh1750_sample);
+}
+
+static const struct path paths[] = {
+    { "d6t-text", d6t_text_setup, d6t_text_step },
+    { "d6t-raw", d6t_raw_setup, d6t_raw_step },
+    { "d6t-ioctl", d6t_plain_setup, d6t_ioctl_step },
+    { "d6t-frames", d6t_plain_setup, d6t_frames_step },
+    { "d6t-ring", d6t_ring_setup, d6t_ring_step },
+    { "bh1750-text", bh1750_text_setup, bh1750_text_step },
+    { "bh1750-binary", bh1750_binary_setup, bh1750_binary_step },
+};
+
+/* ================ MAIN ================ */
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double cpu_us(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s -p PATH -d DEVICE [-n FRAMES] [-w WARMUP] "
+                    "[-l LABEL]\npaths:", prog);
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+        fprintf(stderr, " %s", paths[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const struct path *path = NULL;
+    const char *device = NULL, *label = "";
+    unsigned long frames = 500, warmup = 10, got = 0, steps = 0, fails = 0;
+    struct bench b = { .fd = -1 };
+    uint64_t *lat, t0, start;
+    double cpu0, sec;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "p:d:n:w:l:")) != -1) {
+        switch (opt) {
+        case 'p':
+            for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+                if (!strcmp(optarg, paths[i].name))
+                    path = &paths[i];
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            warmup = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path || !device || !frames) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    b.fd = open(device, O_RDWR);
+    if (b.fd < 0) {
+        perror(device);
+        return 1;
+    }
+    ret = path->setup(&b);
+    if (ret) {
+        fprintf(stderr, "%s: setup: %s\n", path->name, strerror(-ret));
+        return 1;
+    }
+
+    // Warm up caches, the acquisition thread and the first sample
+    for (unsigned long i = 0; i < warmup; i++)
+        path->step(&b);
+
+    lat = calloc(frames, sizeof(*lat));
+    if (!lat)
+        return 1;
+    b.syscalls = 0;
+    cpu0 = cpu_us();
+    start = now_ns();
+    while (got < frames) {
+        t0 = now_ns();
+        ret = path->step(&b);
+        if (ret < 0) {
+            if (ret == -ETIMEDOUT) {
+                fprintf(stderr, "%s: no frames\n", path->name);
+                return 1;
+            }
+            // e.g. PEC errors injected by d6t_stub, but not forever
+            b.errors++;
+            if (++fails >= MAX_ERRORS) {
+                fprintf(stderr, "%s: %d errors in a row, last: %s\n",
+                        path->name, MAX_ERRORS, strerror(-ret));
+                return 1;
+            }
+            continue;
+        }
+        fails = 0;
+        if (!ret)
+            continue;
+        lat[steps++] = now_ns() - t0;
+        got += ret;
+    }
+    sec = (now_ns() - start) / 1e9;
+
+    qsort(lat, steps, sizeof(*lat), cmp_u64);
+    printf("{\"label\":\"%s\",\"path\":\"%s\",\"device\":\"%s\","
+           "\"frames\":%lu,\"steps\":%lu,\"errors\":%lu,"
+           "\"bytes_per_frame\":%zu,\"fps\":%.2f,"
+           "\"lat_p50_us\":%.1f,\"lat_p99_us\":%.1f,\"lat_max_us\":%.1f,"
+           "\"cpu_us_per_frame\":%.2f,\"syscalls_per_frame\":%.3f}\n",
+           label, path->name, device, got, steps, b.errors, b.bytes,
+           got / sec, lat[steps / 2] / 1e3, lat[steps * 99 / 100] / 1e3,
+           lat[steps - 1] / 1e3, (cpu_us() - cpu0) / got,
+           (double)b.syscalls / got);
+
+    free(lat);
+    free(b.buf);
+    if (b.map)
+        munmap(b.map, b.map_len);
+    close(b.fd);
+    return 0;
+}
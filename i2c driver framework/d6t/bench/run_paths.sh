@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Chạy path_bench cho mọi đường đọc của các driver d6t trên d6t_stub,
+# mỗi lần một driver (các driver dùng chung tên class nên không nạp
+# cùng lúc được). Kết quả: mỗi dòng một JSON, nối vào file OUT.
+#
+#   sudo ./run_paths.sh [OUT]        (mặc định paths.jsonl)
+#
+# Biến môi trường:
+#   KO_DIR     thư mục chứa d6t32l.ko, d6t_full.ko, d6tioctl.ko, d6t_stub.ko (..)
+#   FRAMES     số frame cho các đường đọc trực tiếp (500)
+#   STREAM     số frame cho ring / READ_FRAMES / read() của d6t_full,
+#              các đường này chờ frame mới theo chu kỳ cảm biến (25)
+#   STUB_ARGS  tham số cho d6t_stub (bus_khz=400 scene=2)
+#   LABEL      nhãn của lần chạy, mặc định commit hiện tại
+#
+# BH1750 không có giả lập, chỉ đo khi /dev/bh1750 đã có sẵn.
+# Đường đọc không đo được ghi vào OUT dạng {"path":..,"error":..} và
+# script trả về 1.
+
+set -e
+cd "$(dirname "$0")"
+
+KO_DIR=${KO_DIR:-..}
+OUT=${1:-paths.jsonl}
+FRAMES=${FRAMES:-500}
+STREAM=${STREAM:-25}
+STUB_ARGS=${STUB_ARGS:-"bus_khz=400 scene=2"}
+LABEL=${LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+
+gcc -O2 -o path_bench path_bench.c
+
+wait_node() {
+    for _ in $(seq 50); do
+        [ -e "$1" ] && return 0
+        sleep 0.1
+    done
+    echo "$1 không xuất hiện" >&2
+    return 1
+}
+
+failed=0
+
+# fail DRIVER NODE PATH ERROR: ghi lỗi vào OUT thay cho dòng kết quả
+fail() {
+    echo "$1 $3: $4" >&2
+    printf '{"label":"%s","driver":"%s","path":"%s","device":"%s","error":"%s"}\n' \
+        "$LABEL" "$1" "$3" "$2" "$4" >> "$OUT"
+    failed=1
+}
+
+# run DRIVER NODE PATH N [ACQUIRE]
+run() {
+    local drv=$1 node=$2 path=$3 n=$4 acquire=$5
+
+    insmod "$KO_DIR/$drv.ko"
+    # shellcheck disable=SC2086
+    insmod "$KO_DIR/d6t_stub.ko" model=d6t32l01a $STUB_ARGS
+    if ! wait_node "$node"; then
+        fail "$drv" "$node" "$path" "$node không xuất hiện"
+    else
+        [ -n "$acquire" ] && echo 1 > "/sys/class/d6t_class/$(basename "$node")/acquire"
+        ./path_bench -p "$path" -d "$node" -n "$n" -l "$LABEL" >> "$OUT" ||
+            fail "$drv" "$node" "$path" "path_bench thất bại"
+    fi
+    rmmod d6t_stub
+    rmmod "$drv"
+}
+
+run d6t32l /dev/D6T0 d6t-text "$FRAMES"
+run d6t32l /dev/D6T0 d6t-raw "$FRAMES"
+run d6t_full /dev/d6t0 d6t-raw "$STREAM"
+run d6t_full /dev/d6t0 d6t-ring "$STREAM"
+run d6tioctl /dev/d6t0 d6t-ioctl "$FRAMES"
+run d6tioctl /dev/d6t0 d6t-frames "$STREAM" acquire
+
+if [ -e /dev/bh1750 ]; then
+    ./path_bench -p bh1750-text -d /dev/bh1750 -n "$FRAMES" -l "$LABEL" >> "$OUT"
+    ./path_bench -p bh1750-binary -d /dev/bh1750 -n "$STREAM" -l "$LABEL" >> "$OUT"
+fi
+
+echo "Kết quả: $OUT"
+exit $failed
@@ -7,14 +7,69 @@
 #include <linux/device.h>
 #include <linux/delay.h>
 #include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/timekeeping.h>
+#include "d6t_info.h"
+#include "d6t_uapi.h"
+#include "d6t_xfer.h"
+#include "d6t_delta.h"
+#include "d6t_stats.h"
+#include "d6t_retry.h"
+#include "d6t_cadence.h"
+#include "d6t_config.h"
+#include "d6t_temp.h"
+
+#define CREATE_TRACE_POINTS
+#include "d6t_trace.h"
 //#include "d6t_core.h"
 
 #define DRIVER_NAME "D6T"
+#define D6T_MAX_DEVICES 16 // số cảm biến tối đa: /dev/D6T0..15
+
+#define D6T32L_N_READ N_READ(32, 32) // PTAT + 1024 pixel + PEC = 2051 byte
+#define D6T32L_N_RAW (N_PIXELS(32, 32) + 1) // PTAT + 1024 pixel
+#define D6T32L_TEXT_MAX (D6T32L_N_RAW * 7) // "-32768 " cho mỗi giá trị
+
+/* trạng thái riêng của từng cảm biến, lưu bằng i2c_set_clientdata() */
+struct d6t32l {
+	struct i2c_client *client; // NULL sau khi remove
+	struct mutex lock; // khoá bus của riêng cảm biến này
+	struct kref ref; // probe + mỗi file đang mở giữ một tham chiếu
+	struct cdev *cdev;
+	int minor;
+
+	/* cấp phát một lần ở probe, dùng lại cho mọi lần đọc (giữ lock) */
+	u8 *buf; // dữ liệu thô từ I2C
+	s16 *raw; // PTAT + pixel, số đếm có dấu của cảm biến
+	char *text; // chuỗi cho D6T_FORMAT_TEXT
+	void *out; // raw đổi sang D6T_FORMAT_DECI / D6T_FORMAT_MILLI
+	struct d6t_xfer xfer; // cách chia message theo quirks của adapter
+
+	struct d6t_stats stats; // debugfs d6t/D6TN/stats
+	struct d6t_retry retry; // trạng thái thử lại khi đọc frame, giữ lock
+	struct d6t_cadence cadence; // lúc cảm biến có frame mới, giữ lock
+};
+
+/* trạng thái riêng của mỗi file đang mở */
+struct d6t32l_file {
+	struct d6t32l *d6t;
+	u32 format; // enum d6t_format, chọn bằng D6T_IOC_SET_FORMAT
+	struct d6t_delta delta; // bộ mã hoá D6T_FORMAT_DELTA, giữ d6t->lock khi dùng
+};
 
-static struct i2c_client *d6t_client;
-static dev_t d6t_dev_num;
-static struct cdev d6t_cdev;
+/* dùng chung cho mọi cảm biến: vùng chrdev, class, bảng minor -> d6t32l */
+static dev_t d6t_dev_base;
 static struct class *d6t_class;
+static struct dentry *d6t_debugfs_root;
+static DEFINE_IDR(d6t_idr);
+static DEFINE_MUTEX(d6t_idr_lock);
+
+/* chính sách thử lại, chỉnh được qua /sys/module/d6t32l/parameters */
+static struct d6t_retry_policy retry_policy = D6T_RETRY_POLICY_DEFAULT;
+D6T_RETRY_MODULE_PARAMS(retry_policy);
 
 
 //static struct d6t_t d6t;
@@ -22,62 +77,170 @@ static struct class *d6t_class;
 //static u8 buf[5];
 //static uint16_t raw_global[2]; /* consistent type */
 
-/* helper reads into provided uint16_t raw[2] */
-static int d6t_read_helper(uint16_t *raw)
+/* đọc một frame vào d6t->buf, lỗi thì thử lại theo d6t_retry.h */
+static int d6t_bus_read(struct d6t32l *d6t)
 {
-    uint8_t *buf;
+    unsigned int n;
+    u64 t0, ns;
     int ret;
-    int retry;
-
-    buf = kmalloc(2051, GFP_KERNEL);
-    if (!buf)
-        return -ENOMEM;
-
-    for (retry = 0; retry < 10; retry++) {
-        msleep(200); // delay trước mỗi lần đọc
-
-        ret = i2c_smbus_write_byte(d6t_client, 0x4D);
-        if (ret < 0)
-            continue; // thử lại
-
-        int offset = 0;
-        bool error = false;
-
-        while (offset < 2051) {
-            int to_read = min(256, 2051 - offset);
-            ret = i2c_master_recv(d6t_client, buf + offset, to_read);
-            if (ret < 0) {
-                error = true;
-                break; // lỗi, thoát vòng đọc
-            }
-            offset += to_read;
-        }
-
-        if (!error) {
-            // chuyển dữ liệu từ buf sang raw
-            for (int i = 0; i < 2050; i += 2)
-                raw[i / 2] = ((buf[i + 1] << 8) | buf[i]);
-
-            ret = 0; // đọc thành công
-            goto out;
-        }
-
-        // nếu lỗi thì tiếp tục thử lại
-        msleep(20); // delay nhỏ trước lần retry tiếp theo
+
+    /* cảm biến đang bị coi là hỏng: trả lỗi ngay */
+    ret = d6t_retry_begin(&d6t->retry, &retry_policy, &d6t->stats);
+    if (ret)
+        return ret;
+
+    /* lỗi thì thử lại sau 1 ms, 2 ms, 4 ms... thay vì chờ 220 ms */
+    for (n = 1;; n++) {
+        /* lệnh + 2051 byte, chia message theo d6t_xfer.h */
+        trace_d6t_xfer_start(d6t->minor, D6T32L_N_READ,
+                             d6t_xfer_name(&d6t->xfer));
+        t0 = ktime_get_ns();
+        ret = d6t_xfer_read(&d6t->xfer, d6t->buf);
+        ns = ktime_get_ns() - t0;
+        trace_d6t_xfer_end(d6t->minor, D6T32L_N_READ, ret, ns);
+        d6t_stats_xfer(&d6t->stats, D6T32L_N_READ, ret, ns);
+        if (!ret || !d6t_retry_again(&d6t->retry, &retry_policy, n,
+                                     &d6t->stats))
+            break;
     }
+    d6t_retry_end(&d6t->retry, &retry_policy, &d6t->xfer, ret, &d6t->stats);
+    return ret;
+}
 
-    // nếu chạy đến đây là lỗi sau 10 lần
-    ret = -EIO;
+/*
+ * helper reads one frame into d6t->raw, caller holds d6t->lock; lock
+ * được nhả trong lúc chờ frame, cảm biến có thể bị remove giữa chừng
+ */
+static int d6t_read_helper(struct d6t32l *d6t)
+{
+    uint8_t *buf = d6t->buf;
+    s16 *raw = d6t->raw;
+    unsigned int dups = 0;
+    u64 t, t0;
+    int ret;
 
-out:
-    kfree(buf);
-    return ret;
+    /*
+     * thay cho msleep(200) cố định: chờ đến lúc cảm biến có frame mới
+     * (xem d6t_cadence.h), đọc sớm thì frame lặp lại và đọc lại sau
+     * chừng 6 ms
+     */
+    do {
+        ret = d6t_cadence_wait(&d6t->cadence, &d6t->lock);
+        if (ret)
+            return ret;
+        if (!d6t->client)
+            return -ENODEV;
+        t = ktime_get_ns();
+        if (d6t_bus_read(d6t))
+            return -EIO;
+    } while (!d6t_cadence_frame(&d6t->cadence, t, buf, D6T32L_N_READ,
+                                &d6t->stats) &&
+             ++dups < D6T_CADENCE_MAX_REPEATS);
+
+    t0 = trace_d6t_convert_enabled() ? ktime_get_ns() : 0;
+    // chuyển dữ liệu từ buf sang raw (little-endian, có dấu)
+    d6t_temp_counts(buf, raw, D6T32L_N_RAW);
+    if (t0)
+        trace_d6t_convert(d6t->minor, D6T32L_N_RAW, 0,
+                          ktime_get_ns() - t0);
+
+    return 0; // đọc thành công
+}
+
+/* ===================== TEXT FORMAT ======================== */
+/* bảng 2 chữ số "00".."99": đổi 2 chữ số mỗi lần chia */
+static const char d6t_digits2[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* ghi v dạng thập phân vào p, trả về vị trí sau chữ số cuối */
+static inline char *d6t_put_u16(char *p, u16 v)
+{
+	char tmp[5], *t = tmp + sizeof(tmp);
+	int n;
+
+	while (v >= 100) {
+		u16 q = v / 100;
+
+		t -= 2;
+		memcpy(t, &d6t_digits2[(v - q * 100) * 2], 2);
+		v = q;
+	}
+	if (v >= 10) {
+		t -= 2;
+		memcpy(t, &d6t_digits2[v * 2], 2);
+	} else {
+		*--t = '0' + v;
+	}
+
+	n = tmp + sizeof(tmp) - t;
+	memcpy(p, t, n);
+	return p + n;
+}
+
+/* như d6t_put_u16, thêm dấu '-' cho số âm */
+static inline char *d6t_put_s16(char *p, s16 v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return d6t_put_u16(p, -(s32)v);
+	}
+	return d6t_put_u16(p, v);
+}
+
+/* cùng định dạng với "%d ", không qua scnprintf */
+static int d6t_format_text(const s16 *raw, char *text)
+{
+	char *p = text;
+
+	for (int i = 0; i < D6T32L_N_RAW; i++) {
+		p = d6t_put_s16(p, raw[i]);
+		*p++ = ' ';
+	}
+	return p - text;
 }
 
 /* ===================== FILE OPS ======================== */
+static void d6t32l_free(struct d6t32l *d6t)
+{
+	kfree(d6t->buf);
+	kfree(d6t->raw);
+	kfree(d6t->text);
+	kfree(d6t->out);
+	kfree(d6t);
+}
+
+static void d6t32l_release(struct kref *ref)
+{
+	d6t32l_free(container_of(ref, struct d6t32l, ref));
+}
+
 static int d6t_open(struct inode *inode, struct file *file)
 {
-	pr_info("device: opened\n");
+	struct d6t32l_file *f;
+	struct d6t32l *d6t;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	/* chỉ lấy tham chiếu khi cảm biến chưa bị remove */
+	mutex_lock(&d6t_idr_lock);
+	d6t = idr_find(&d6t_idr, iminor(inode));
+	if (d6t)
+		kref_get(&d6t->ref);
+	mutex_unlock(&d6t_idr_lock);
+	if (!d6t) {
+		kfree(f);
+		return -ENODEV;
+	}
+
+	f->d6t = d6t;
+	f->format = D6T_FORMAT_TEXT;
+	d6t_delta_init(&f->delta);
+	file->private_data = f;
+	pr_info("device: D6T%d opened\n", d6t->minor);
 
 	/* khởi tạo struct d6t (sửa cú pháp, thêm dấu ; ) */
 //	d6t = (struct d6t_t){
@@ -99,7 +262,12 @@ static int d6t_open(struct inode *inode, struct file *file)
 
 static int d6t_release(struct inode *inode, struct file *file)
 {
-	pr_info("device: released\n");
+	struct d6t32l_file *f = file->private_data;
+
+	pr_info("device: D6T%d released\n", f->d6t->minor);
+	kref_put(&f->d6t->ref, d6t32l_release);
+	d6t_delta_free(&f->delta);
+	kfree(f);
 
 
 	return 0;
@@ -107,30 +275,65 @@ static int d6t_release(struct inode *inode, struct file *file)
 
 static ssize_t d6t_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
 {
-   uint16_t *raw = kmalloc_array(1025, sizeof(uint16_t), GFP_KERNEL);
-char *raw_str = kmalloc(6200, GFP_KERNEL); 
-    int len = 0, ret;
-
-    if (!raw || !raw_str) { ret = -ENOMEM; goto out_free; }
+    struct d6t32l_file *f = file->private_data;
+    struct d6t32l *d6t = f->d6t;
+    const void *out;
+    int len, ret;
+    u64 t0, t_call = ktime_get_ns();
+
+    /* DELTA là luồng bản ghi, không có EOF */
+    if (*ppos > 0 && f->format != D6T_FORMAT_DELTA)
+        return 0;
+
+    /* mỗi cảm biến có khoá riêng, các bus khác nhau đọc song song */
+    mutex_lock(&d6t->lock);
+    ret = d6t->client ? d6t_read_helper(d6t) : -ENODEV;
+    if (ret < 0) {
+        // -ERESTARTSYS: tín hiệu đến trong lúc chờ frame
+        if (ret != -ENODEV && ret != -ERESTARTSYS)
+            ret = -EIO;
+        goto out_unlock;
+    }
 
-    if (*ppos > 0) { ret = 0; goto out_free; }
+    /* d6t_deliver đo từ đây: đổi định dạng + copy_to_user */
+    t0 = trace_d6t_deliver_enabled() ? ktime_get_ns() : 0;
+    if (f->format == D6T_FORMAT_DELTA) {
+        ret = d6t_delta_read(&f->delta, d6t->raw, D6T32L_N_RAW, ubuf, count);
+        goto out_trace;
+    }
 
-    if (d6t_read_helper(raw) < 0) { ret = -EIO; goto out_free; }
+    if (f->format == D6T_FORMAT_RAW) {
+        out = d6t->raw;
+        len = D6T32L_N_RAW * sizeof(s16);
+    } else if (d6t_temp_format(f->format)) {
+        out = d6t->out;
+        len = d6t_temp_convert(&d6t_info_tbl[D6T_32L_01A], f->format,
+                               d6t->raw, d6t->out, D6T32L_N_RAW);
+    } else {
+        out = d6t->text;
+        len = d6t_format_text(d6t->raw, d6t->text);
+    }
 
-    for (int i = 0; i < 1025; i++)
-        len += scnprintf(raw_str + len, 6200 - len, "%u ", raw[i]);
+    if (count < len) {
+        ret = -EINVAL;
+        goto out_trace;
+    }
 
-    if (copy_to_user(ubuf, raw_str, len))
+    if (copy_to_user(ubuf, out, len)) {
         ret = -EFAULT;
-    else {
+    } else {
         *ppos += len;
         ret = len;
     }
 
-out_free:
-  kfree(raw);
-  kfree(raw_str);
-    
+out_trace:
+    if (t0)
+        trace_d6t_deliver(d6t->minor, count, ret, ktime_get_ns() - t0);
+    if (ret > 0)
+        d6t_stats_add(&d6t->stats, D6T_STAT_BYTES_OUT, ret);
+out_unlock:
+    mutex_unlock(&d6t->lock);
+    d6t_stats_call(&d6t->stats, ret, ktime_get_ns() - t_call);
     return ret;
 }
 
@@ -155,9 +358,91 @@ static ssize_t d6t_write(struct file *file, const char __user *ubuf,
 	return count;
 }
 
+/* cấu hình IIR/AVG/chu kỳ đọc lại từ cảm biến, xem d6t_config.h */
+static int d6t_get_config(struct d6t32l *d6t, struct d6t_config *cfg)
+{
+	int ret;
+
+	mutex_lock(&d6t->lock);
+	if (!d6t->client)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_read(d6t->client, &d6t_info_tbl[D6T_32L_01A],
+				      cfg);
+	mutex_unlock(&d6t->lock);
+	return ret;
+}
+
+/* ghi các mục trong cfg->mask, cfg nhận lại giá trị đọc từ cảm biến */
+static int d6t_set_config(struct d6t32l *d6t, struct d6t_config *cfg)
+{
+	u32 mask = cfg->mask;
+	int ret;
+
+	mutex_lock(&d6t->lock);
+	if (!d6t->client)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_write(d6t->client, &d6t_info_tbl[D6T_32L_01A],
+				       cfg);
+	/* đổi chu kỳ thì ước lượng lại nhịp frame từ đầu */
+	if (!ret && (mask & D6T_CFG_CYCLE))
+		d6t_cadence_init(&d6t->cadence, cfg->cycle_ms);
+	mutex_unlock(&d6t->lock);
+	return ret;
+}
+
 static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct d6t32l_file *f = file->private_data;
+	struct d6t_config config;
+	struct d6t_delta_cfg cfg;
+	struct d6t_dev_info info;
+	u32 format;
+	int ret;
+
 	switch (cmd) {
+	case D6T_IOC_SET_FORMAT:
+		if (get_user(format, (u32 __user *)arg))
+			return -EFAULT;
+		if (format != D6T_FORMAT_TEXT && format != D6T_FORMAT_RAW &&
+		    format != D6T_FORMAT_DELTA && !d6t_temp_format(format))
+			return -EINVAL;
+		mutex_lock(&f->d6t->lock);
+		f->format = format;
+		d6t_delta_reset(&f->delta); // bắt đầu lại bằng keyframe
+		mutex_unlock(&f->d6t->lock);
+		return 0;
+	case D6T_IOC_GET_INFO:
+		d6t_info_fill(&info, &d6t_info_tbl[D6T_32L_01A],
+			      D6T_CAP_FMT_TEXT | D6T_CAP_FMT_RAW |
+			      D6T_CAP_FMT_DELTA | D6T_CAP_CONFIG |
+			      D6T_CAP_FMT_DECI | D6T_CAP_FMT_MILLI, f->format);
+		if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+	case D6T_IOC_SET_DELTA:
+		if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+			return -EFAULT;
+		mutex_lock(&f->d6t->lock);
+		f->delta.cfg = cfg;
+		mutex_unlock(&f->d6t->lock);
+		return 0;
+	case D6T_IOC_GET_CONFIG:
+	case D6T_IOC_SET_CONFIG:
+		if (cmd == D6T_IOC_SET_CONFIG) {
+			if (copy_from_user(&config, (void __user *)arg,
+					   sizeof(config)))
+				return -EFAULT;
+			ret = d6t_set_config(f->d6t, &config);
+		} else {
+			ret = d6t_get_config(f->d6t, &config);
+		}
+		if (ret)
+			return ret;
+		if (copy_to_user((void __user *)arg, &config, sizeof(config)))
+			return -EFAULT;
+		return 0;
 	case 1:
 		pr_info("device: ioctl command 1 received\n");
 		return 0;
@@ -179,53 +464,137 @@ static const struct file_operations d6t_fops = {
 	.unlocked_ioctl = d6t_ioctl,
 };
 
+/* ===================== SYSFS ======================== */
+/* cách đọc frame đang dùng: tên chiến lược và số byte mỗi message */
+static ssize_t xfer_strategy_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct d6t32l *d6t = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&d6t->lock);
+	ret = sysfs_emit(buf, "%s %u\n", d6t_xfer_name(&d6t->xfer),
+			 d6t->xfer.chunk);
+	mutex_unlock(&d6t->lock);
+	return ret;
+}
+static DEVICE_ATTR_RO(xfer_strategy);
+
+/* iir, avg, cycle_ms: đọc/ghi thẳng thanh ghi của cảm biến */
+D6T_CONFIG_ATTR(iir, D6T_CFG_IIR, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(avg, D6T_CFG_AVG, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(cycle_ms, D6T_CFG_CYCLE, d6t_get_config, d6t_set_config);
+
+static struct attribute *d6t_attrs[] = {
+	&dev_attr_xfer_strategy.attr,
+	&dev_attr_iir.attr,
+	&dev_attr_avg.attr,
+	&dev_attr_cycle_ms.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(d6t);
+
 /* ===================== PROBE / REMOVE ======================== */
 static int d6t_probe(struct i2c_client *client)
 {
-	int ret;
+	struct d6t32l *d6t;
 	struct device *dev_ret;
+	int ret;
 
-	d6t_client = client;
+	d6t = kzalloc(sizeof(*d6t), GFP_KERNEL);
+	if (!d6t)
+		return -ENOMEM;
+	d6t->client = client;
+	mutex_init(&d6t->lock);
+	kref_init(&d6t->ref);
+
+	d6t->buf = kmalloc(D6T32L_N_READ, GFP_KERNEL);
+	d6t->raw = kmalloc_array(D6T32L_N_RAW, sizeof(s16), GFP_KERNEL);
+	d6t->text = kmalloc(D6T32L_TEXT_MAX, GFP_KERNEL);
+	d6t->out = kmalloc(d6t_temp_size(D6T_FORMAT_MILLI, D6T32L_N_RAW),
+			   GFP_KERNEL);
+	if (!d6t->buf || !d6t->raw || !d6t->text || !d6t->out) {
+		ret = -ENOMEM;
+		goto free_data;
+	}
 
-	ret = alloc_chrdev_region(&d6t_dev_num, 0, 1, DRIVER_NAME);
-	if (ret < 0)
-		return ret;
+	ret = d6t_xfer_init(&d6t->xfer, client,
+			    d6t_info_tbl[D6T_32L_01A].command, D6T32L_N_READ);
+	if (ret < 0) {
+		dev_err(&client->dev, "adapter không hỗ trợ I2C thuần\n");
+		goto free_data;
+	}
 
-	cdev_init(&d6t_cdev, &d6t_fops);
-	ret = cdev_add(&d6t_cdev, d6t_dev_num, 1);
+	d6t_cadence_init(&d6t->cadence, d6t_info_tbl[D6T_32L_01A].cycle_ms);
+
+	/* giữ chỗ minor, chỉ công bố cho open() khi node đã tạo xong */
+	mutex_lock(&d6t_idr_lock);
+	ret = idr_alloc(&d6t_idr, NULL, 0, D6T_MAX_DEVICES, GFP_KERNEL);
+	mutex_unlock(&d6t_idr_lock);
 	if (ret < 0)
-		goto unregister_region;
+		goto free_data;
+	d6t->minor = ret;
 
-	d6t_class = class_create("d6t_class");
-	if (IS_ERR(d6t_class)) {
-		ret = PTR_ERR(d6t_class);
-		goto del_cdev;
+	d6t->cdev = cdev_alloc();
+	if (!d6t->cdev) {
+		ret = -ENOMEM;
+		goto free_minor;
+	}
+	d6t->cdev->ops = &d6t_fops;
+	d6t->cdev->owner = THIS_MODULE;
+	ret = cdev_add(d6t->cdev, d6t_dev_base + d6t->minor, 1);
+	if (ret < 0) {
+		kobject_put(&d6t->cdev->kobj);
+		goto free_minor;
 	}
 
-	dev_ret = device_create(d6t_class, NULL, d6t_dev_num, NULL, DRIVER_NAME);
+	dev_ret = device_create_with_groups(d6t_class, &client->dev,
+					    d6t_dev_base + d6t->minor, d6t,
+					    d6t_groups, DRIVER_NAME "%d",
+					    d6t->minor);
 	if (IS_ERR(dev_ret)) {
 		ret = PTR_ERR(dev_ret);
-		goto destroy_class;
+		goto del_cdev;
 	}
 
-	dev_info(&client->dev, "%s probed successfully\n", DRIVER_NAME);
+	d6t_stats_init(&d6t->stats, d6t_debugfs_root, dev_name(dev_ret));
+
+	i2c_set_clientdata(client, d6t);
+	mutex_lock(&d6t_idr_lock);
+	idr_replace(&d6t_idr, d6t, d6t->minor);
+	mutex_unlock(&d6t_idr_lock);
+
+	dev_info(&client->dev, "%s%d probed successfully, %s transfers\n",
+		 DRIVER_NAME, d6t->minor, d6t_xfer_name(&d6t->xfer));
 	return 0;
 
-destroy_class:
-	class_destroy(d6t_class);
 del_cdev:
-	cdev_del(&d6t_cdev);
-unregister_region:
-	unregister_chrdev_region(d6t_dev_num, 1);
+	cdev_del(d6t->cdev);
+free_minor:
+	mutex_lock(&d6t_idr_lock);
+	idr_remove(&d6t_idr, d6t->minor);
+	mutex_unlock(&d6t_idr_lock);
+free_data:
+	d6t32l_free(d6t);
 	return ret;
 }
 
 static void d6t_remove(struct i2c_client *client)
 {
-	device_destroy(d6t_class, d6t_dev_num);
-	class_destroy(d6t_class);
-	cdev_del(&d6t_cdev);
-	unregister_chrdev_region(d6t_dev_num, 1);
+	struct d6t32l *d6t = i2c_get_clientdata(client);
+
+	mutex_lock(&d6t_idr_lock);
+	idr_remove(&d6t_idr, d6t->minor);
+	mutex_unlock(&d6t_idr_lock);
+	d6t_stats_remove(&d6t->stats);
+	device_destroy(d6t_class, d6t_dev_base + d6t->minor);
+	cdev_del(d6t->cdev);
+
+	/* file còn mở sẽ nhận -ENODEV, bộ nhớ giải phóng khi đóng file cuối */
+	mutex_lock(&d6t->lock);
+	d6t->client = NULL;
+	mutex_unlock(&d6t->lock);
+	kref_put(&d6t->ref, d6t32l_release);
 	dev_info(&client->dev, "%s removed\n", DRIVER_NAME);
 }
 
@@ -233,12 +602,18 @@ static void d6t_remove(struct i2c_client *client)
 #ifdef CONFIG_OF
 static const struct of_device_id d6t_of_match[] = {
 	{ .compatible = "omron,d6t" },
+	{ .compatible = "omron,d6t32l01a" },
 	{ }
 };
 MODULE_DEVICE_TABLE(of, d6t_of_match);
 #endif
 
-static const struct i2c_device_id d6t_id[] = { { DRIVER_NAME, 0 }, { } };
+/* "d6t32l01a": tên model, như d6t_full/d6tioctl và client của d6t_stub */
+static const struct i2c_device_id d6t_id[] = {
+	{ DRIVER_NAME, 0 },
+	{ "d6t32l01a", 0 },
+	{ }
+};
 MODULE_DEVICE_TABLE(i2c, d6t_id);
 
 static struct i2c_driver device_driver = {
@@ -251,7 +626,46 @@ static struct i2c_driver device_driver = {
 	.id_table = d6t_id,
 };
 
-module_i2c_driver(device_driver);
+static int __init d6t_module_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&d6t_dev_base, 0, D6T_MAX_DEVICES, DRIVER_NAME);
+	if (ret < 0)
+		return ret;
+
+	d6t_class = class_create("d6t_class");
+	if (IS_ERR(d6t_class)) {
+		ret = PTR_ERR(d6t_class);
+		goto unregister_region;
+	}
+
+	d6t_debugfs_root = debugfs_create_dir("d6t", NULL);
+
+	ret = i2c_add_driver(&device_driver);
+	if (ret < 0)
+		goto remove_debugfs;
+	return 0;
+
+remove_debugfs:
+	debugfs_remove(d6t_debugfs_root);
+	class_destroy(d6t_class);
+unregister_region:
+	unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+	return ret;
+}
+
+static void __exit d6t_module_exit(void)
+{
+	i2c_del_driver(&device_driver);
+	debugfs_remove(d6t_debugfs_root);
+	class_destroy(d6t_class);
+	unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+	idr_destroy(&d6t_idr);
+}
+
+module_init(d6t_module_init);
+module_exit(d6t_module_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("ABC");
@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_cadence.h - frame timing of the omron d6t drivers
+ *
+ * The sensor latches a new frame once per cycle, a read before that
+ * returns the previous frame again. Whether a read got a new frame is
+ * decided from timing, with the bytes (jhash) only as a hint:
+ *
+ *  - bytes that differ from the last frame are a new frame;
+ *  - the same bytes are a duplicate while the read is less than a
+ *    period (plus period / 8 for estimate error) after the read of the
+ *    last new frame. Later than that the sensor has latched a frame
+ *    since, it just saw the same scene; a static scene or the 5 byte
+ *    d6t01a frame does that all the time.
+ *
+ * The period and the time of the next frame are estimated from the
+ * outcome:
+ *
+ *  - a duplicate means the read was early. It is repeated slack later
+ *    (period / 32); when the bytes then change, that pins the frame edge
+ *    to within slack;
+ *  - the time between two pinned edges over the frames between them
+ *    refines the period;
+ *  - after a new frame the next read is planned one period later, less
+ *    a small lead (period / 1024). The lead doubles on every frame once
+ *    16 have gone by without a duplicate: a sensor running faster than
+ *    the estimate never repeats a frame, so reads drifting late behind
+ *    it are only found by reading early on purpose.
+ *
+ * In steady state a read lands at most slack after the frame is ready,
+ * with about one duplicate in twenty frames. A static scene costs a few
+ * duplicates per frame and delivers it up to period / 8 late.
+ *
+ * Readers wait with d6t_cadence_wait(), which drops the bus lock while
+ * asleep, so settings and non-blocking readers are not held up for up
+ * to a period. Anything read under the lock before must be checked
+ * again after it, the sensor may have been removed meanwhile.
+*/
+#ifndef _D6T_CADENCE_H
+#define _D6T_CADENCE_H
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include "d6t_stats.h"
+
+#define D6T_CADENCE_SLACK_SHIFT 5
+#define D6T_CADENCE_LEAD_SHIFT 10
+#define D6T_CADENCE_PROBE_AFTER 16 // New frames in a row before the lead grows
+#define D6T_CADENCE_TOL_SHIFT 3
+#define D6T_CADENCE_MAX_REPEATS 64 // Safety net, timing ends a run of duplicates after ~5
+#define D6T_CADENCE_TIMER_SLACK_NS (100 * NSEC_PER_USEC)
+
+// Per sensor, under the driver's bus lock
+struct d6t_cadence {
+	u64 period_ns; // Estimated sensor period
+	u64 next_ns; // CLOCK_MONOTONIC time the next frame is due, 0: now
+	u64 edge_ns; // Last frame edge pinned by a duplicate, 0: none yet
+	u64 lead_ns; // Read this much before the frame is expected
+	u64 frame_ns; // Time of the read that got the last new frame
+	u32 since_edge; // New frames since edge_ns
+	u32 hash; // Of the last new frame
+	bool have_hash;
+	bool after_dup; // The last read returned a duplicate
+};
+
+static inline void d6t_cadence_init(struct d6t_cadence *c, u16 cycle_ms)
+{
+	memset(c, 0, sizeof(*c));
+	c->period_ns = (u64)cycle_ms * NSEC_PER_MSEC;
+	c->lead_ns = c->period_ns >> D6T_CADENCE_LEAD_SHIFT;
+}
+
+static inline u64 d6t_cadence_slack(const struct d6t_cadence *c)
+{
+	return c->period_ns >> D6T_CADENCE_SLACK_SHIFT;
+}
+
+/*
+@brief Account a frame read
+@param t_ns CLOCK_MONOTONIC time the transfer started
+@param buf frame as read from the bus, PEC included
+@return true for a new frame, false for the previous one again
+*/
+static inline bool d6t_cadence_frame(struct d6t_cadence *c, u64 t_ns,
+				     const u8 *buf, u32 len,
+				     struct d6t_stats *stats)
+{
+	u32 h = jhash(buf, len, 0);
+	u64 p, tol = c->period_ns >> D6T_CADENCE_TOL_SHIFT;
+	bool same = c->have_hash && h == c->hash;
+
+	// Same bytes only count as a duplicate while no edge can have passed
+	if (same && t_ns < c->frame_ns + c->period_ns + tol) {
+		d6t_stats_inc(stats, D6T_STAT_DUPLICATES);
+		c->after_dup = true;
+		c->next_ns = t_ns + d6t_cadence_slack(c);
+		return false;
+	}
+	c->hash = h;
+	c->have_hash = true;
+	c->frame_ns = t_ns;
+
+	if (c->after_dup) {
+		// Only a change of bytes pins the edge, within slack before t_ns
+		if (!same) {
+			if (c->edge_ns && c->since_edge) {
+				p = div_u64(t_ns - c->edge_ns, c->since_edge);
+				// Further off means frames went unseen in between
+				if (p > c->period_ns - tol && p < c->period_ns + tol)
+					c->period_ns += (p >> 2) - (c->period_ns >> 2);
+			}
+			c->edge_ns = t_ns;
+			c->since_edge = 0;
+		}
+		c->after_dup = false;
+		c->lead_ns = c->period_ns >> D6T_CADENCE_LEAD_SHIFT;
+	}
+	if (++c->since_edge > D6T_CADENCE_PROBE_AFTER)
+		c->lead_ns = min(c->lead_ns * 2, c->period_ns >> 2);
+	c->next_ns = t_ns + c->period_ns - c->lead_ns;
+	return true;
+}
+
+// A failed read, try again one period later
+static inline void d6t_cadence_failed(struct d6t_cadence *c, u64 t_ns)
+{
+	c->next_ns = t_ns + c->period_ns;
+}
+
+/*
+@brief Readers: sleep until the next frame is due
+@param lock the bus lock, held on entry and on return, dropped while asleep
+@return 0, or -ERESTARTSYS on a signal
+*/
+static inline int d6t_cadence_wait(const struct d6t_cadence *c,
+				   struct mutex *lock)
+{
+	ktime_t due = ns_to_ktime(c->next_ns);
+	int ret = 0;
+
+	if (c->next_ns <= ktime_get_ns())
+		return 0;
+	mutex_unlock(lock);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!schedule_hrtimeout_range(&due, D6T_CADENCE_TIMER_SLACK_NS,
+					      HRTIMER_MODE_ABS))
+			break;
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+	}
+	mutex_lock(lock);
+	return ret;
+}
+
+// Acquisition threads: sleep until @due_ns or kthread_stop()
+static inline void d6t_cadence_sleep_kthread(u64 due_ns)
+{
+	ktime_t due = ns_to_ktime(due_ns);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (kthread_should_stop()) {
+		__set_current_state(TASK_RUNNING);
+		return;
+	}
+	schedule_hrtimeout_range(&due, D6T_CADENCE_TIMER_SLACK_NS,
+				 HRTIMER_MODE_ABS);
+}
+
+#endif /* _D6T_CADENCE_H */
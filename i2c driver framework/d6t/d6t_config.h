@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_config.h - IIR, averaging and cycle settings of the omron d6t drivers
+ *
+ * IIR and averaging share iir_avg_reg, IIR in the upper nibble and
+ * averaging in the lower one. cycle_reg holds the frame period in units
+ * of cycle_unit_ms. Which registers a model has and the values it takes
+ * come from d6t_info_tbl; every write is read back, so what is reported
+ * is what the sensor uses.
+ *
+ * Driver side, with the bus lock held:
+ *
+ *	mask = cfg.mask;
+ *	ret = d6t_config_write(client, info, &cfg);
+ *	if (!ret && (mask & D6T_CFG_CYCLE))
+ *		d6t_cadence_init(&cadence, cfg.cycle_ms);
+ *
+ * and D6T_CONFIG_ATTR() for the matching sysfs attributes.
+*/
+#ifndef _D6T_CONFIG_H
+#define _D6T_CONFIG_H
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/i2c.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+#include "d6t_info.h"
+#include "d6t_uapi.h"
+#include "d6t_xfer.h"
+
+static inline bool d6t_reg_supported(s8 reg)
+{
+	return reg != (s8)NOT_SUPPORT;
+}
+
+// D6T_CFG_* the model has
+static inline u32 d6t_config_mask(const struct d6t_info *info)
+{
+	u32 mask = 0;
+
+	if (d6t_reg_supported(info->iir_avg_reg))
+		mask |= D6T_CFG_IIR | D6T_CFG_AVG;
+	if (d6t_reg_supported(info->cycle_reg))
+		mask |= D6T_CFG_CYCLE;
+	return mask;
+}
+
+static inline int d6t_reg_write(struct i2c_client *client, u8 reg, u8 val)
+{
+	u8 wbuf[2] = { reg, val };
+	struct i2c_msg msg = {
+		.addr = client->addr, .flags = 0, .len = 2, .buf = wbuf
+	};
+
+	return d6t_xfer_check(i2c_transfer(client->adapter, &msg, 1), 1);
+}
+
+static inline int d6t_reg_read(struct i2c_client *client, u8 reg, u8 *val)
+{
+	const struct i2c_adapter_quirks *q = client->adapter->quirks;
+	struct i2c_msg msgs[2] = {
+		{ .addr = client->addr, .flags = 0, .len = 1, .buf = &reg },
+		{ .addr = client->addr, .flags = I2C_M_RD, .len = 1, .buf = val },
+	};
+	int ret;
+
+	if (!q || !(q->flags & I2C_AQ_NO_REP_START))
+		return d6t_xfer_check(i2c_transfer(client->adapter, msgs, 2), 2);
+
+	// The register pointer survives the STOP, as for frame reads
+	ret = d6t_xfer_check(i2c_transfer(client->adapter, msgs, 1), 1);
+	if (!ret)
+		ret = d6t_xfer_check(i2c_transfer(client->adapter, &msgs[1], 1),
+				     1);
+	return ret;
+}
+
+/*
+@brief Read the settings back from the sensor
+@param cfg filled in, mask and limits from the model table
+@return 0 or negative errno
+*/
+static inline int d6t_config_read(struct i2c_client *client,
+				  const struct d6t_info *info,
+				  struct d6t_config *cfg)
+{
+	u8 val;
+	int ret;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->mask = d6t_config_mask(info);
+	cfg->iir_max = info->iir_max;
+	cfg->avg_max = info->avg_max;
+	cfg->cycle_unit_ms = info->cycle_unit_ms;
+	cfg->cycle_min_ms = info->cycle_min_ms;
+	cfg->cycle_max_ms = info->cycle_max_ms;
+
+	if (cfg->mask & D6T_CFG_IIR) {
+		ret = d6t_reg_read(client, info->iir_avg_reg, &val);
+		if (ret)
+			return ret;
+		cfg->iir = val >> 4;
+		cfg->avg = val & 0x0f;
+	}
+	if (cfg->mask & D6T_CFG_CYCLE) {
+		ret = d6t_reg_read(client, info->cycle_reg, &val);
+		if (ret)
+			return ret;
+		cfg->cycle_ms = val * info->cycle_unit_ms;
+	}
+	return 0;
+}
+
+/*
+@brief Check the settings named in cfg->mask against the model
+@return 0, -EOPNOTSUPP for a setting the model lacks, -EINVAL out of range
+*/
+static inline int d6t_config_check(const struct d6t_info *info,
+				   const struct d6t_config *cfg)
+{
+	if (cfg->mask & ~d6t_config_mask(info))
+		return -EOPNOTSUPP;
+	if ((cfg->mask & D6T_CFG_IIR) && cfg->iir > info->iir_max)
+		return -EINVAL;
+	if ((cfg->mask & D6T_CFG_AVG) && cfg->avg > info->avg_max)
+		return -EINVAL;
+	if ((cfg->mask & D6T_CFG_CYCLE) &&
+	    (cfg->cycle_ms < info->cycle_min_ms ||
+	     cfg->cycle_ms > info->cycle_max_ms ||
+	     cfg->cycle_ms % info->cycle_unit_ms))
+		return -EINVAL;
+	return 0;
+}
+
+/*
+@brief Apply the settings named in cfg->mask and read all of them back
+@param cfg in: mask and values, out: as from d6t_config_read()
+@return 0, an error of d6t_config_check(), or -EIO if the sensor did not
+        take a value
+*/
+static inline int d6t_config_write(struct i2c_client *client,
+				   const struct d6t_info *info,
+				   struct d6t_config *cfg)
+{
+	struct d6t_config want = *cfg;
+	int ret;
+
+	ret = d6t_config_check(info, &want);
+	if (ret)
+		return ret;
+
+	// IIR and averaging share a register, keep the one not being set
+	ret = d6t_config_read(client, info, cfg);
+	if (ret)
+		return ret;
+	if (want.mask & D6T_CFG_IIR)
+		cfg->iir = want.iir;
+	if (want.mask & D6T_CFG_AVG)
+		cfg->avg = want.avg;
+	if (want.mask & D6T_CFG_CYCLE)
+		cfg->cycle_ms = want.cycle_ms;
+
+	if (want.mask & (D6T_CFG_IIR | D6T_CFG_AVG)) {
+		ret = d6t_reg_write(client, info->iir_avg_reg,
+				    cfg->iir << 4 | cfg->avg);
+		if (ret)
+			return ret;
+	}
+	if (want.mask & D6T_CFG_CYCLE) {
+		ret = d6t_reg_write(client, info->cycle_reg,
+				    cfg->cycle_ms / info->cycle_unit_ms);
+		if (ret)
+			return ret;
+	}
+
+	ret = d6t_config_read(client, info, cfg);
+	if (ret)
+		return ret;
+	if (((want.mask & D6T_CFG_IIR) && cfg->iir != want.iir) ||
+	    ((want.mask & D6T_CFG_AVG) && cfg->avg != want.avg) ||
+	    ((want.mask & D6T_CFG_CYCLE) && cfg->cycle_ms != want.cycle_ms)) {
+		dev_warn(&client->dev,
+			 "Settings not taken: iir %u avg %u cycle %u ms read back\n",
+			 cfg->iir, cfg->avg, cfg->cycle_ms);
+		return -EIO;
+	}
+	return 0;
+}
+
+static inline ssize_t d6t_config_emit(const struct d6t_config *cfg, u32 field,
+				      char *buf)
+{
+	if (!(cfg->mask & field))
+		return -EOPNOTSUPP;
+	switch (field) {
+	case D6T_CFG_IIR:
+		return sysfs_emit(buf, "%u\n", cfg->iir);
+	case D6T_CFG_AVG:
+		return sysfs_emit(buf, "%u\n", cfg->avg);
+	default:
+		return sysfs_emit(buf, "%u\n", cfg->cycle_ms);
+	}
+}
+
+static inline int d6t_config_parse(const char *buf, u32 field,
+				   struct d6t_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->mask = field;
+	switch (field) {
+	case D6T_CFG_IIR:
+		return kstrtou8(buf, 0, &cfg->iir);
+	case D6T_CFG_AVG:
+		return kstrtou8(buf, 0, &cfg->avg);
+	default:
+		return kstrtou16(buf, 0, &cfg->cycle_ms);
+	}
+}
+
+/*
+ * Read-write sysfs attribute for one setting. get(drvdata, cfg) and
+ * set(drvdata, cfg) are the driver's locked wrappers of
+ * d6t_config_read() and d6t_config_write().
+ */
+#define D6T_CONFIG_ATTR(_name, _field, _get, _set)                             \
+	static ssize_t _name##_show(struct device *dev,                        \
+				    struct device_attribute *attr, char *buf)  \
+	{                                                                      \
+		struct d6t_config cfg;                                         \
+		int ret = _get(dev_get_drvdata(dev), &cfg);                    \
+									       \
+		return ret ? ret : d6t_config_emit(&cfg, _field, buf);         \
+	}                                                                      \
+	static ssize_t _name##_store(struct device *dev,                       \
+				     struct device_attribute *attr,            \
+				     const char *buf, size_t count)            \
+	{                                                                      \
+		struct d6t_config cfg;                                         \
+		int ret = d6t_config_parse(buf, _field, &cfg);                 \
+									       \
+		if (!ret)                                                      \
+			ret = _set(dev_get_drvdata(dev), &cfg);                \
+		return ret ? ret : count;                                      \
+	}                                                                      \
+	static DEVICE_ATTR_RW(_name)
+
+#endif /* _D6T_CONFIG_H */
@@ -10,6 +10,7 @@
 #include <linux/printk.h>
 #include <linux/string.h>
 #include "d6t_core.h"
+#include "d6t_crc.h"
 
 static inline struct d6t_t *d6t_init(const char *name)
 {
@@ -148,16 +149,7 @@ static inline u32 d6t_read_data(struct i2c_client *client, struct d6t_t *d6t)
 
 static inline u32 calc_crc(uint8_t data)
 {
-	u32 index;
-	u8 temp;
-	for (index = 0; index < 8; index++) {
-		temp = data;
-		data <<= 1;
-		if (temp & 0x80) {
-			data ^= 0x07;
-		}
-	}
-	return data;
+	return d6t_crc8_byte(0, data);
 }
 
 static inline u32 d6t_write(struct i2c_client *client, struct d6t_t *d6t,
@@ -174,12 +166,9 @@ static inline u32 d6t_write(struct i2c_client *client, struct d6t_t *d6t,
 
 static inline u32 d6t_checkPEC(struct i2c_client *client, struct d6t_t *d6t)
 {
-	u32 i;
 	u32 n = d6t->n_read - 1;
 	u8 crc = calc_crc(((client->addr) << 1) | 1); // I2C Read address (8bit)
-	for (i = 0; i < n; i++) {
-		crc = calc_crc(d6t->buffer[i] ^ crc);
-	}
+	crc = d6t_crc8(crc, d6t->buffer, n);
 	u32 ret = crc != d6t->buffer[n];
 	if (ret) {
 		pr_info("PEC check failed: %02X(cal)-%02X(get)\n", crc,
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_delta.h - D6T_FORMAT_DELTA encoder of the omron d6t drivers
+ *
+ * Each open file in delta format keeps the frame its reader has rebuilt
+ * so far. A record carries the values that moved by more than the
+ * threshold from that frame; a keyframe with every value is sent first,
+ * every key_interval records, and whenever it would be the smaller one.
+ * Record layout is in d6t_uapi.h.
+*/
+#ifndef _D6T_DELTA_H
+#define _D6T_DELTA_H
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include "d6t_uapi.h"
+
+#define D6T_DELTA_DEF_THRESHOLD 2 // 0.2 degC
+#define D6T_DELTA_DEF_KEY_INTERVAL 32
+#define D6T_DELTA_NO_KEY U32_MAX // since_key before the first keyframe
+
+struct d6t_delta {
+	struct d6t_delta_cfg cfg;
+	s16 *ref; // Frame as the reader has it, valid after a keyframe
+	struct d6t_delta_px *px; // Encode buffer, n entries
+	u16 n; // Values per frame
+	u32 seq; // Records sent
+	u32 since_key; // Records since the last keyframe
+};
+
+static inline void d6t_delta_init(struct d6t_delta *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->cfg.threshold = D6T_DELTA_DEF_THRESHOLD;
+	d->cfg.key_interval = D6T_DELTA_DEF_KEY_INTERVAL;
+	d->since_key = D6T_DELTA_NO_KEY;
+}
+
+// Next record is a keyframe
+static inline void d6t_delta_reset(struct d6t_delta *d)
+{
+	d->since_key = D6T_DELTA_NO_KEY;
+}
+
+static inline void d6t_delta_free(struct d6t_delta *d)
+{
+	kfree(d->ref);
+	kfree(d->px);
+	d->ref = NULL;
+	d->px = NULL;
+	d->n = 0;
+}
+
+static inline int d6t_delta_prepare(struct d6t_delta *d, u16 n)
+{
+	if (d->ref && d->n == n)
+		return 0;
+
+	d6t_delta_free(d);
+	d->ref = kmalloc_array(n, sizeof(*d->ref), GFP_KERNEL);
+	d->px = kmalloc_array(n, sizeof(*d->px), GFP_KERNEL);
+	if (!d->ref || !d->px) {
+		d6t_delta_free(d);
+		return -ENOMEM;
+	}
+	d->n = n;
+	d6t_delta_reset(d);
+	return 0;
+}
+
+/*
+@brief Encode one frame as a delta record and copy it to the reader
+@param d encoder state of the open file, serialized by the caller
+@param raw frame, PTAT then pixels
+@param n values in raw
+@param ubuf user buffer
+@param count size of ubuf, must fit a keyframe
+@return record length, or negative errno with the state unchanged
+*/
+static inline ssize_t d6t_delta_read(struct d6t_delta *d, const s16 *raw,
+				     u16 n, char __user *ubuf, size_t count)
+{
+	struct d6t_delta_hdr hdr = { 0 };
+	u32 interval = d->cfg.key_interval;
+	size_t key_len = sizeof(hdr) + n * sizeof(s16);
+	const void *payload;
+	size_t len;
+	bool key;
+	u16 k = 0;
+	int ret;
+
+	// Whatever comes next, the reader must be able to take a keyframe
+	if (count < key_len)
+		return -EINVAL;
+
+	ret = d6t_delta_prepare(d, n);
+	if (ret)
+		return ret;
+
+	key = d->since_key == D6T_DELTA_NO_KEY ||
+	      (interval && d->since_key + 1 >= interval);
+	for (u16 i = 0; !key && i < n; i++) {
+		if (abs(raw[i] - d->ref[i]) <= d->cfg.threshold)
+			continue;
+		// Past half the values the keyframe is smaller
+		if (k >= n / 2) {
+			key = true;
+			break;
+		}
+		d->px[k].index = i;
+		d->px[k].value = raw[i];
+		k++;
+	}
+
+	hdr.seq = d->seq + 1;
+	hdr.flags = key ? D6T_DELTA_KEY : 0;
+	hdr.count = key ? n : k;
+	payload = key ? (const void *)raw : (const void *)d->px;
+	len = key ? key_len : sizeof(hdr) + k * sizeof(*d->px);
+
+	if (copy_to_user(ubuf, &hdr, sizeof(hdr)) ||
+	    copy_to_user(ubuf + sizeof(hdr), payload, len - sizeof(hdr)))
+		return -EFAULT;
+
+	// The reader has the record, move its frame along
+	if (key) {
+		memcpy(d->ref, raw, n * sizeof(s16));
+		d->since_key = 0;
+	} else {
+		for (u16 i = 0; i < k; i++)
+			d->ref[d->px[i].index] = d->px[i].value;
+		d->since_key++;
+	}
+	d->seq++;
+	return len;
+}
+
+#endif /* _D6T_DELTA_H */
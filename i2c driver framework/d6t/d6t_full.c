@@ -26,85 +26,135 @@
 #include <linux/device.h>
 #include <linux/delay.h>
 #include <linux/ioctl.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/jiffies.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
+#include "d6t_uapi.h"
+#include "d6t_crc.h"
+#include "d6t_info.h"
+#include "d6t_xfer.h"
+#include "d6t_delta.h"
+#include "d6t_stats.h"
+#include "d6t_retry.h"
+#include "d6t_cadence.h"
+#include "d6t_config.h"
+#include "d6t_temp.h"
+
+#define CREATE_TRACE_POINTS
+#include "d6t_trace.h"
 
 // ================ DEFINES ========================
 #define DRIVER_NAME "d6t"
+#define D6T_MAX_DEVICES 16 // Minors reserved for /dev/d6t0..15
 
-#define N_PIXELS(row, col) ((row) * (col))
-#define N_READ(row, col) \
-	(2 * (1 + N_PIXELS(row, col)) + 1) // 2 bytes per pixel and PTAT + 1 byte for CRC
-
-#define NOT_SUPPORT 0xFF
-
-//IOCTL COMMANDS
-#define D6T_IOC_MAGIC 'x'
-#define D6T_IOC_INIT _IOW(D6T_IOC_MAGIC, 0, char *) //(copy_from_user)
-#define D6T_IOC_CLEAR _IO(D6T_IOC_MAGIC, 1)
+#define D6T_RING_MIN_DEPTH 2
+#define D6T_RING_MAX_DEPTH 256
 
 // ================ STRUCTURES ========================
 struct d6t_info;
 struct d6t_data {
-	//Manage d6t operation
-	struct d6t_info *d6t_info;
-	struct mutex lock;
+	//Per sensor instance, stored with i2c_set_clientdata()
+	struct i2c_client *client; // NULL once the sensor is removed
+	struct kref ref; // Held by probe, open files and ring mappings
+	struct cdev *cdev;
+	int minor;
+	int open_count; // Open files, under lock
+
+	//Manage d6t operation, model and buffers change under ring_lock + lock
+	const struct d6t_info *d6t_info;
+	struct mutex lock; // Serializes bus access, buf, raw and out
 	u8 *buf;
-	u16 *raw;
+	s16 *raw; // Sensor counts, PTAT first
+	void *out; // raw in D6T_FORMAT_DECI or D6T_FORMAT_MILLI
 	u16 n_read; // Number of bytes to read
 	u16 n_raw_data; // Number of raw data points
+	struct d6t_xfer xfer; // Frame read layout for this adapter
+
+	//O_NONBLOCK reads: raw holds a sample nobody has read yet
+	struct work_struct sample_work; // Background capture into raw
+	bool sample_ready; // raw is fresh, protected by lock
+	int sample_err; // Error of the last background capture, under lock
+	struct fasync_struct *async_queue; // SIGIO when a sample is ready
+
+	//Frames put into raw by any path, read() follows them while the
+	//ring producer owns the bus, under lock
+	u64 raw_seq;
+	bool raw_valid; // raw holds a frame, not just the buffer from INIT
+	u32 raw_pec; // enum d6t_pec_status of the frame in raw
+
+	//mmap frame ring, filled by the producer thread while mapped
+	struct mutex ring_lock; // Protects the fields below
+	void *ring; // vmalloc_user() area, starts with struct d6t_ring_hdr
+	size_t ring_size;
+	u32 ring_depth;
+	u32 ring_policy; // enum d6t_ring_policy
+	u32 ring_slot_size;
+	u64 ring_head; // Kernel copy of hdr->head, never read back from user
+	u64 ring_dropped;
+	int map_count;
+	struct task_struct *producer;
+	wait_queue_head_t frame_wq; // Woken on every ring frame
+
+	struct d6t_stats stats; // debugfs d6t/d6tN/stats
+	struct d6t_retry retry; // Frame read retries, under lock
+	struct d6t_cadence cadence; // When the sensor has a new frame, under lock
 };
 
-enum {
-	D6T_01A,
-	D6T_32L_01A,
+// Per open file state
+struct d6t_file {
+	struct d6t_data *d6t_data;
+	u32 format; // enum d6t_format, any but D6T_FORMAT_TEXT
+	struct d6t_delta delta; // D6T_FORMAT_DELTA encoder, under d6t_data->lock
+	u64 seen_seq; // raw_seq of the last frame read, under d6t_data->lock
 };
 
-struct d6t_info {
-	const char *model_name;
-	u8 command;
-	u8 row;
-	u8 col;
-	s8 status_reg;
-	s8 iir_avg_reg;
-	s8 cycle_reg;
-};
+static unsigned int ring_depth = 8;
+module_param(ring_depth, uint, 0644);
+MODULE_PARM_DESC(ring_depth, "Frames in the mmap ring, applied on init (2-256)");
 
+static unsigned int ring_policy = D6T_RING_OVERWRITE;
+module_param(ring_policy, uint, 0644);
+MODULE_PARM_DESC(ring_policy,
+		 "Ring full policy, applied on init: 0=overwrite oldest, 1=drop newest");
 
-struct d6t_info d6t_info_tbl[] = {
-	[D6T_01A] = { "d6t01a", 0x4C, 1, 1, NOT_SUPPORT, NOT_SUPPORT,
-		      NOT_SUPPORT },
-	[D6T_32L_01A] = { "d6t32l01a", 0x4D, 32, 32, 0x00, 0x01, 0x02 },
-	/* Add more models here if needed */
-};
+static struct d6t_retry_policy retry_policy = D6T_RETRY_POLICY_DEFAULT;
+D6T_RETRY_MODULE_PARAMS(retry_policy);
 
-static struct i2c_client *d6t_client;
-static dev_t d6t_dev_num;
-static struct cdev d6t_cdev;
+// Shared by all sensors: one chrdev region and class, minor -> d6t_data
+static dev_t d6t_dev_base;
+static struct dentry *d6t_debugfs_root;
 static struct class *d6t_class;
-static struct d6t_data* d6t_data;
+static DEFINE_IDR(d6t_idr);
+static DEFINE_MUTEX(d6t_idr_lock); // Protects d6t_idr and open() lookups
 
 /* ================ FUNCTION DECLARATIONS ======================== */
 static int ioctl_d6t_init(struct d6t_data* d6t_data,const char *name);
 static int ioctl_d6t_clear(struct d6t_data* d6t_data);
+static void d6t_data_release(struct kref *ref);
 static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
-static int d6t_read(struct file *file, char __user *buf, size_t count,
+static ssize_t d6t_read(struct file *file, char __user *buf, size_t count,
 		    loff_t *ppos);
-static int d6t_write(struct file *file, const char __user *buf, size_t count,
+static ssize_t d6t_write(struct file *file, const char __user *buf, size_t count,
 		     loff_t *ppos);
+static int d6t_mmap(struct file *file, struct vm_area_struct *vma);
+static __poll_t d6t_poll(struct file *file, poll_table *wait);
+static int d6t_ring_alloc(struct d6t_data *d6t_data);
 static int d6t_open(struct inode *inode, struct file *file);
 static int d6t_release(struct inode *inode, struct file *file);
+static int d6t_fasync(int fd, struct file *file, int on);
 static int d6t_probe(struct i2c_client *client);
 static void d6t_remove(struct i2c_client *client);
 
-/* ===================== FILE OPS ======================== */
-static struct file_operations d6t_fops = {
-	.owner = THIS_MODULE,
-	.read = d6t_read,
-	.write = d6t_write,
-	.unlocked_ioctl = d6t_ioctl,
-	.open = d6t_open,
-	.release = d6t_release,
-};
-
 /* ===================== FILE OPS TABLE ======================== */
 static struct file_operations d6t_fops = {
 	.owner = THIS_MODULE,
@@ -113,6 +163,9 @@ static struct file_operations d6t_fops = {
 	.open = d6t_open,
 	.release = d6t_release,
 	.unlocked_ioctl = d6t_ioctl,
+	.mmap = d6t_mmap,
+	.poll = d6t_poll,
+	.fasync = d6t_fasync,
 };
 
 /* ===================== MATCHING ======================== */
@@ -124,7 +177,8 @@ MODULE_DEVICE_TABLE(of, d6t_of_match);
 #endif
 
 static const struct i2c_device_id d6t_id[] = { { "d6t01a", D6T_01A },
-					       { "d6t32l01a", D6T_32L_01A } };
+					       { "d6t32l01a", D6T_32L_01A },
+					       {} };
 MODULE_DEVICE_TABLE(i2c, d6t_id);
 
 static struct i2c_driver d6t_driver = {
@@ -132,12 +186,51 @@ static struct i2c_driver d6t_driver = {
         .name = "d6t",
         .of_match_table = of_match_ptr(d6t_of_match),
     },
-    .probe_new = d6t_probe,
+    .probe = d6t_probe,
     .remove = d6t_remove,
     .id_table = d6t_id,
 };
 
-module_i2c_driver(d6t_driver);
+static int __init d6t_module_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&d6t_dev_base, 0, D6T_MAX_DEVICES, DRIVER_NAME);
+	if (ret < 0)
+		return ret;
+
+	d6t_class = class_create("d6t_class");
+	if (IS_ERR(d6t_class)) {
+		ret = PTR_ERR(d6t_class);
+		goto unregister_region;
+	}
+
+	d6t_debugfs_root = debugfs_create_dir("d6t", NULL);
+
+	ret = i2c_add_driver(&d6t_driver);
+	if (ret < 0)
+		goto remove_debugfs;
+	return 0;
+
+remove_debugfs:
+	debugfs_remove(d6t_debugfs_root);
+	class_destroy(d6t_class);
+unregister_region:
+	unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+	return ret;
+}
+
+static void __exit d6t_module_exit(void)
+{
+	i2c_del_driver(&d6t_driver);
+	debugfs_remove(d6t_debugfs_root);
+	class_destroy(d6t_class);
+	unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+	idr_destroy(&d6t_idr);
+}
+
+module_init(d6t_module_init);
+module_exit(d6t_module_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("NGUYEN DUY BACH");
@@ -146,8 +239,11 @@ MODULE_VERSION("1.0");
 
 // ================ FUNCTIONS IMPLEMENTATION ========================
 // IOCTL FUNCTIONS
+// Caller holds ring_lock, then lock
 static int ioctl_d6t_init(struct d6t_data* d6t_data, const char *name)
 {
+	int ret = -ENOMEM;
+
 	if (strcmp(name, "d6t01a") == 0)
 		d6t_data->d6t_info = &d6t_info_tbl[D6T_01A];
 	else if (strcmp(name, "d6t32l01a") == 0)
@@ -160,26 +256,67 @@ static int ioctl_d6t_init(struct d6t_data* d6t_data, const char *name)
 
 	d6t_data->n_read = N_READ(d6t_data->d6t_info->row, d6t_data->d6t_info->col);
 	d6t_data->n_raw_data = N_PIXELS(d6t_data->d6t_info->row, d6t_data->d6t_info->col) + 1; // +1 for PTAT
-		
+
+	if (!d6t_data->client ||
+	    d6t_xfer_init(&d6t_data->xfer, d6t_data->client,
+			  d6t_data->d6t_info->command, d6t_data->n_read)) {
+		pr_err("D6T: Adapter cannot read a %u byte frame\n",
+		       d6t_data->n_read);
+		ret = -EOPNOTSUPP;
+		goto err_model;
+	}
+
 	d6t_data->buf = kmalloc(d6t_data->n_read * sizeof(u8), GFP_KERNEL);
 	if (!d6t_data->buf) {
 		pr_err("D6T: Failed to allocate buffer\n");
-		return -ENOMEM;
+		goto err_model;
 	}
 
-	d6t_data->raw = kmalloc(d6t_data->n_raw_data * sizeof(u16), GFP_KERNEL);
+	d6t_data->raw = kmalloc(d6t_data->n_raw_data * sizeof(s16), GFP_KERNEL);
 	if (!d6t_data->raw) {
-		kfree(d6t_data->buf);
 		pr_err("D6T: Failed to allocate raw data buffer\n");
-		return -ENOMEM;
+		goto free_buf;
 	}
 
-	mutex_init(&d6t_data->lock);
-	pr_info("D6T: Initialized with model %s\n",
-		d6t_data->d6t_info->model_name);
+	d6t_data->out = kmalloc(d6t_temp_size(D6T_FORMAT_MILLI,
+					      d6t_data->n_raw_data), GFP_KERNEL);
+	if (!d6t_data->out) {
+		pr_err("D6T: Failed to allocate output buffer\n");
+		goto free_raw;
+	}
+
+	if (d6t_ring_alloc(d6t_data)) {
+		pr_err("D6T: Failed to allocate frame ring\n");
+		goto free_out;
+	}
+
+	d6t_cadence_init(&d6t_data->cadence, d6t_data->d6t_info->cycle_ms);
+
+	pr_info("D6T: Initialized with model %s, %s transfers\n",
+		d6t_data->d6t_info->model_name, d6t_xfer_name(&d6t_data->xfer));
 	return 0;
+
+	// Back to uninitialized, INIT can be tried again
+free_out:
+	kfree(d6t_data->out);
+	d6t_data->out = NULL;
+free_raw:
+	kfree(d6t_data->raw);
+	d6t_data->raw = NULL;
+free_buf:
+	kfree(d6t_data->buf);
+	d6t_data->buf = NULL;
+err_model:
+	d6t_data->d6t_info = NULL;
+	d6t_data->n_read = 0;
+	d6t_data->n_raw_data = 0;
+	return ret;
 }
 
+/*
+ * Caller holds ring_lock, then lock, so no read or capture is using the
+ * buffers. A background capture still to come finds d6t_info NULL.
+ */
 static int ioctl_d6t_clear(struct d6t_data* d6t_data)
 {
 	if (!d6t_data->d6t_info) {
@@ -187,11 +324,26 @@ static int ioctl_d6t_clear(struct d6t_data* d6t_data)
 		return -EINVAL;
 	}
 
+	if (d6t_data->map_count) {
+		pr_warn("D6T: Frame ring still mapped\n");
+		return -EBUSY;
+	}
+	vfree(d6t_data->ring);
+	d6t_data->ring = NULL;
+
+	// Running already means waiting for lock, it bails out on d6t_info
+	cancel_work(&d6t_data->sample_work);
+	d6t_data->sample_ready = false;
+	d6t_data->sample_err = 0;
+	d6t_data->raw_valid = false;
+
 	kfree(d6t_data->buf);
 	kfree(d6t_data->raw);
+	kfree(d6t_data->out);
 	d6t_data->d6t_info = NULL;
 	d6t_data->buf = NULL;
 	d6t_data->raw = NULL;
+	d6t_data->out = NULL;
 	d6t_data->n_read = 0;
 	d6t_data->n_raw_data = 0;
 
@@ -199,23 +351,155 @@ static int ioctl_d6t_clear(struct d6t_data* d6t_data)
 	return 0;
 }
 
+// Sensor settings as read back, see d6t_config.h
+static int d6t_get_config(struct d6t_data *d6t_data, struct d6t_config *cfg)
+{
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (!d6t_data->client || !d6t_data->d6t_info)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_read(d6t_data->client, d6t_data->d6t_info, cfg);
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+
+// Apply the settings in cfg->mask, cfg gets what the sensor read back
+static int d6t_set_config(struct d6t_data *d6t_data, struct d6t_config *cfg)
+{
+	u32 mask = cfg->mask;
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (!d6t_data->client || !d6t_data->d6t_info)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_write(d6t_data->client, d6t_data->d6t_info, cfg);
+	// Frames now come at the new period, estimate it from there
+	if (!ret && (mask & D6T_CFG_CYCLE))
+		d6t_cadence_init(&d6t_data->cadence, cfg->cycle_ms);
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+
+// Last reference gone: no open file, no mapping and no i2c client left
+static void d6t_data_release(struct kref *ref)
+{
+	struct d6t_data *d6t_data = container_of(ref, struct d6t_data, ref);
+
+	cancel_work_sync(&d6t_data->sample_work);
+	mutex_lock(&d6t_data->ring_lock);
+	mutex_lock(&d6t_data->lock);
+	if (d6t_data->d6t_info)
+		ioctl_d6t_clear(d6t_data);
+	mutex_unlock(&d6t_data->lock);
+	mutex_unlock(&d6t_data->ring_lock);
+	kfree(d6t_data);
+}
+
 static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+
 	switch (cmd) {
 	case D6T_IOC_INIT: {
-		char name[32];
+		char name[D6T_MODEL_NAME_MAX];
+		int ret;
+
 		if (copy_from_user(&name, (int __user *)arg, sizeof(name)))
 			return -EFAULT;
+		name[sizeof(name) - 1] = '\0';
 		pr_info("Received from user: %s\n", name);
-		if (ioctl_d6t_init(d6t_data,name))
-			return -EFAULT;
-		//pr_info("Init D6T model %s sucessfully\n", name);
+		mutex_lock(&d6t_data->ring_lock);
+		mutex_lock(&d6t_data->lock);
+		if (d6t_data->d6t_info)
+			ret = -EBUSY;
+		else
+			ret = ioctl_d6t_init(d6t_data, name);
+		mutex_unlock(&d6t_data->lock);
+		mutex_unlock(&d6t_data->ring_lock);
+		if (ret)
+			return ret;
 		break;
 	}
 
 	case D6T_IOC_CLEAR: {
+		int ret;
+
 		pr_info("D6T_IOC_CLEAR called\n");
-		if (ioctl_d6t_clear(d6t_data))
+		mutex_lock(&d6t_data->ring_lock);
+		mutex_lock(&d6t_data->lock);
+		// Other files may be reading, only the last one may clear
+		if (d6t_data->open_count > 1) {
+			pr_warn("D6T: Device open by %d other files\n",
+				d6t_data->open_count - 1);
+			ret = -EBUSY;
+		} else {
+			ret = ioctl_d6t_clear(d6t_data);
+		}
+		mutex_unlock(&d6t_data->lock);
+		mutex_unlock(&d6t_data->ring_lock);
+		if (ret)
+			return ret;
+		break;
+	}
+
+	case D6T_IOC_SET_FORMAT: {
+		u32 format;
+
+		if (get_user(format, (u32 __user *)arg))
+			return -EFAULT;
+		if (format != D6T_FORMAT_RAW && format != D6T_FORMAT_DELTA &&
+		    !d6t_temp_format(format))
+			return -EINVAL;
+		mutex_lock(&d6t_data->lock);
+		f->format = format;
+		d6t_delta_reset(&f->delta);
+		mutex_unlock(&d6t_data->lock);
+		break;
+	}
+
+	case D6T_IOC_GET_INFO: {
+		struct d6t_dev_info info;
+
+		// Geometry appears once D6T_IOC_INIT has named the model
+		d6t_info_fill(&info, READ_ONCE(d6t_data->d6t_info),
+			      D6T_CAP_RING | D6T_CAP_FMT_RAW | D6T_CAP_FMT_DELTA |
+			      D6T_CAP_FMT_DECI | D6T_CAP_FMT_MILLI |
+			      D6T_CAP_CONFIG, f->format);
+		if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+			return -EFAULT;
+		break;
+	}
+
+	case D6T_IOC_SET_DELTA: {
+		struct d6t_delta_cfg cfg;
+
+		if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+			return -EFAULT;
+		mutex_lock(&d6t_data->lock);
+		f->delta.cfg = cfg;
+		mutex_unlock(&d6t_data->lock);
+		break;
+	}
+
+	case D6T_IOC_GET_CONFIG:
+	case D6T_IOC_SET_CONFIG: {
+		struct d6t_config cfg;
+		int ret;
+
+		if (cmd == D6T_IOC_SET_CONFIG) {
+			if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+				return -EFAULT;
+			ret = d6t_set_config(d6t_data, &cfg);
+		} else {
+			ret = d6t_get_config(d6t_data, &cfg);
+		}
+		if (ret)
+			return ret;
+		if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
 			return -EFAULT;
 		break;
 	}
@@ -227,31 +511,18 @@ static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 }
 
 // READ / WRITE FUNCTIONS
-static u8 d6t_crc8(u8 crc, u8 data)
-{
-    crc ^= data;
-    for (int i = 0; i < 8; i++) {
-        if (crc & 0x80)
-            crc = (crc << 1) ^ 0x07;
-        else
-            crc <<= 1;
-    }
-    return crc;
-}
-
 static bool d6t_checkPEC(struct i2c_client *client, struct d6t_data * d6t_data)
 {
     u32 n =  d6t_data->n_read - 1; // Last byte is CRC
     u8 crc = 0; // initial value
     u8 addr = (client->addr << 1) | 1; // I2C Read address (8 bit)
 
-    crc = d6t_crc8(crc, addr); // Start with address
-
-    for (u32 i = 0; i < n; i++) {
-        crc = d6t_crc8(crc, d6t_data->buf[i]);
-    }
+    crc = d6t_crc8_byte(crc, addr); // Start with address
+    crc = d6t_crc8(crc, d6t_data->buf, n);
 
+    trace_d6t_pec(d6t_data->minor, d6t_data->n_read, crc, d6t_data->buf[n]);
     if (crc !=  d6t_data->buf[n]) {
+        d6t_stats_inc(&d6t_data->stats, D6T_STAT_PEC_FAIL);
         pr_info("PEC check failed: calc=%02X get=%02X\n", crc, d6t_data->buf[n]);
         return true; // ERROR
     }
@@ -259,90 +530,344 @@ static bool d6t_checkPEC(struct i2c_client *client, struct d6t_data * d6t_data)
 }
 
 static int d6t_get_frame(struct i2c_client *d6t_client, struct d6t_data *d6t_data){
+	u64 t0, ns;
+	unsigned int n;
 	int ret;
-	struct i2c_msg msgs[2];
-	u8 command = d6t_data->d6t_info->command;
 
 	if (!d6t_client || !d6t_data || !d6t_data->buf) {
 		pr_err("D6T: Invalid client or data structure\n");
 		return -EINVAL;
 	}
-	
-	msgs[0].addr = d6t_client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = 1;
-	msgs[0].buf = &command;
-	
-	msgs[1].addr = d6t_client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = d6t_data->n_read;;
-	msgs[1].buf = d6t_data->buf;
 
-	memset(d6t_data->buf, 0, msgs[1].len);
+	// Sensor taken as down, see d6t_retry.h
+	ret = d6t_retry_begin(&d6t_data->retry, &retry_policy, &d6t_data->stats);
+	if (ret)
+		return ret;
 
-	ret = i2c_transfer(d6t_client->adapter, msgs, 2);
+	memset(d6t_data->buf, 0, d6t_data->n_read);
+
+	for (n = 1;; n++) {
+		trace_d6t_xfer_start(d6t_data->minor, d6t_data->n_read,
+				     d6t_xfer_name(&d6t_data->xfer));
+		t0 = ktime_get_ns();
+		// Message layout follows the adapter quirks, see d6t_xfer.h
+		ret = d6t_xfer_read(&d6t_data->xfer, d6t_data->buf);
+		ns = ktime_get_ns() - t0;
+		trace_d6t_xfer_end(d6t_data->minor, d6t_data->n_read, ret, ns);
+		d6t_stats_xfer(&d6t_data->stats, d6t_data->n_read, ret, ns);
+		if (!ret || !d6t_retry_again(&d6t_data->retry, &retry_policy, n,
+					     &d6t_data->stats))
+			break;
+	}
+	d6t_retry_end(&d6t_data->retry, &retry_policy, &d6t_data->xfer, ret,
+		      &d6t_data->stats);
 	if (ret < 0) {
-		pr_err("D6T: I2C transfer failed: %d\n", ret);
+		pr_err("D6T: I2C transfer (%s) failed: %d\n",
+		       d6t_xfer_name(&d6t_data->xfer), ret);
 		return ret;
 	}
-	
-	if (ret != 2) {
-		pr_err("D6T: I2C transfer returned %d messages, expected 2\n", ret);
-		return -EIO;
-	}
 	return 0;
 }
 
 static inline int d6t_convert_u8_to_s16(struct d6t_data *d6t_data){
 	u32 n = d6t_data->n_raw_data;
-	for (u32 i = 0; i < n; i++) {
-		d6t_data->raw[i] = (d6t_data->buf[2 * i + 1] << 8) | d6t_data->buf[2 * i];
-	}
+	u64 t0 = trace_d6t_convert_enabled() ? ktime_get_ns() : 0;
+
+	d6t_temp_counts(d6t_data->buf, d6t_data->raw, n);
+	d6t_data->raw_seq++;
+	d6t_data->raw_valid = true;
+	d6t_data->raw_pec = D6T_PEC_OK;
+	if (t0)
+		trace_d6t_convert(d6t_data->minor, n, 0,
+				  ktime_get_ns() - t0);
 	return 0;
 }
 
-static int d6t_read(struct file *file, char __user *buf, size_t count,
-		    loff_t *ppos)
+/*
+ * Wait until the sensor has a frame the caller has not seen and read it
+ * into buf, see d6t_cadence.h. Caller holds lock, which is dropped while
+ * waiting; -ENODEV if the sensor was removed or cleared meanwhile,
+ * -ENOENT if the ring producer started and owns the bus now.
+ */
+static int d6t_get_new_frame(struct d6t_data *d6t_data)
+{
+	struct d6t_cadence *c = &d6t_data->cadence;
+	unsigned int n = 0;
+	u64 t;
+	int ret;
+
+	do {
+		ret = d6t_cadence_wait(c, &d6t_data->lock);
+		if (ret)
+			return ret;
+		if (!d6t_data->client || !d6t_data->d6t_info)
+			return -ENODEV;
+		if (READ_ONCE(d6t_data->producer))
+			return -ENOENT;
+		t = ktime_get_ns();
+		ret = d6t_get_frame(d6t_data->client, d6t_data);
+		if (ret < 0)
+			return ret;
+	} while (!d6t_cadence_frame(c, t, d6t_data->buf, d6t_data->n_read,
+				    &d6t_data->stats) &&
+		 ++n < D6T_CADENCE_MAX_REPEATS);
+	return 0;
+}
+
+/*
+ * Background capture for O_NONBLOCK readers. The result lands in raw
+ * (or sample_err) and is announced through poll() and SIGIO. Not while
+ * the ring producer runs, its frames serve those readers then.
+ */
+static void d6t_sample_work(struct work_struct *work)
 {
-	//struct d6t_data *d6t_data = file->private_data;
+	struct d6t_data *d6t_data =
+		container_of(work, struct d6t_data, sample_work);
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	// Cleared after this was queued, nothing to capture into
+	if (!d6t_data->d6t_info || READ_ONCE(d6t_data->producer)) {
+		mutex_unlock(&d6t_data->lock);
+		return;
+	}
+	if (!d6t_data->client)
+		ret = -ENODEV;
+	else
+		ret = d6t_get_new_frame(d6t_data);
+	// Cleared, or the producer took over, while waiting for the frame
+	if (!d6t_data->d6t_info || ret == -ENOENT) {
+		mutex_unlock(&d6t_data->lock);
+		return;
+	}
+	if (!ret && d6t_checkPEC(d6t_data->client, d6t_data))
+		ret = -EIO;
+	if (!ret)
+		d6t_convert_u8_to_s16(d6t_data);
+	d6t_data->sample_ready = !ret;
+	d6t_data->sample_err = ret;
+	mutex_unlock(&d6t_data->lock);
+
+	wake_up_interruptible(&d6t_data->frame_wq);
+	kill_fasync(&d6t_data->async_queue, SIGIO, POLL_IN);
+}
+
+// Hand d6t_data->raw to the reader in its format. Caller holds lock.
+static ssize_t __d6t_emit(struct d6t_file *f, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct d6t_data *d6t_data = f->d6t_data;
+	const void *out = d6t_data->raw;
+	size_t len = d6t_data->n_raw_data * sizeof(s16);
+
+	// Delta records are a stream, file position does not apply
+	if (f->format == D6T_FORMAT_DELTA)
+		return d6t_delta_read(&f->delta, d6t_data->raw,
+				      d6t_data->n_raw_data, buf, count);
+
+	if (d6t_temp_format(f->format))
+		len = d6t_temp_size(f->format, d6t_data->n_raw_data);
+	if (count < len)
+		return -EINVAL;
+
+	// Scaled here, raw stays in counts for the ring and other files
+	if (d6t_temp_format(f->format)) {
+		d6t_temp_convert(d6t_data->d6t_info, f->format, d6t_data->raw,
+				 d6t_data->out, d6t_data->n_raw_data);
+		out = d6t_data->out;
+	}
+
+	if (copy_to_user(buf, out, len)) {
+		pr_err("D6T: Failed to copy data to user space\n");
+		return -EFAULT;
+	}
+	*ppos += len;
+	return len;
+}
+
+static ssize_t d6t_emit(struct d6t_file *f, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	u64 t0 = trace_d6t_deliver_enabled() ? ktime_get_ns() : 0;
+	ssize_t ret = __d6t_emit(f, buf, count, ppos);
+
+	if (t0)
+		trace_d6t_deliver(f->d6t_data->minor, count, ret,
+				  ktime_get_ns() - t0);
+	if (ret > 0)
+		d6t_stats_add(&f->d6t_data->stats, D6T_STAT_BYTES_OUT, ret);
+	return ret;
+}
+
+/*
+ * While the ring producer runs it alone reads the sensor, so that every
+ * frame reaches the ring; read() hands out the producer's frames from
+ * raw, each once per file. -ENOENT once there is no producer, the
+ * caller then reads the sensor itself.
+ */
+static ssize_t d6t_read_produced(struct d6t_file *f, char __user *buf,
+				 size_t count, loff_t *ppos, bool nonblock)
+{
+	struct d6t_data *d6t_data = f->d6t_data;
+	ssize_t ret;
+
+	for (;;) {
+		mutex_lock(&d6t_data->lock);
+		if (!d6t_data->d6t_info) {
+			mutex_unlock(&d6t_data->lock);
+			return -EINVAL;
+		}
+		if (d6t_data->raw_valid && d6t_data->raw_seq != f->seen_seq) {
+			f->seen_seq = d6t_data->raw_seq;
+			// Stored in the ring flagged, but read() reports it
+			ret = d6t_data->raw_pec == D6T_PEC_OK ?
+				      d6t_emit(f, buf, count, ppos) :
+				      -EIO;
+			mutex_unlock(&d6t_data->lock);
+			return ret;
+		}
+		mutex_unlock(&d6t_data->lock);
+
+		if (!READ_ONCE(d6t_data->producer))
+			return -ENOENT;
+		if (nonblock)
+			return -EAGAIN;
+		ret = wait_event_interruptible(d6t_data->frame_wq,
+				(READ_ONCE(d6t_data->raw_valid) &&
+				 READ_ONCE(d6t_data->raw_seq) != f->seen_seq) ||
+				!READ_ONCE(d6t_data->producer));
+		if (ret)
+			return ret;
+	}
+}
+
+/*
+ * O_NONBLOCK read: hand out the sample captured in the background, or
+ * start a capture and return -EAGAIN. The bus lock is only tried, a
+ * transfer in flight means a sample is on its way.
+ */
+static ssize_t d6t_read_nonblock(struct d6t_file *f, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct d6t_data *d6t_data = f->d6t_data;
+	ssize_t ret;
+
+	if (!mutex_trylock(&d6t_data->lock))
+		return -EAGAIN;
+
+	if (!d6t_data->d6t_info) {
+		mutex_unlock(&d6t_data->lock);
+		return -EINVAL;
+	}
+
+	if (d6t_data->sample_err) {
+		ret = d6t_data->sample_err;
+		d6t_data->sample_err = 0;
+		mutex_unlock(&d6t_data->lock);
+		return ret;
+	}
+
+	if (!d6t_data->sample_ready) {
+		mutex_unlock(&d6t_data->lock);
+		schedule_work(&d6t_data->sample_work);
+		return -EAGAIN;
+	}
+
+	f->seen_seq = d6t_data->raw_seq;
+	ret = d6t_emit(f, buf, count, ppos);
+	if (ret > 0)
+		d6t_data->sample_ready = false;
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+
+static ssize_t __d6t_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+	ssize_t ret;
+
 	if (!d6t_data || !d6t_data->d6t_info || !d6t_data->buf || !d6t_data->raw) {
 		pr_err("D6T: Device not initialized or memory not allocated\n");
 		return -EINVAL;
 	}
 
-	if (*ppos > 0) {
+	if (*ppos > 0 && f->format != D6T_FORMAT_DELTA) {
 		return 0; // EOF
 	}
 
+retry:
+	if (READ_ONCE(d6t_data->producer)) {
+		ret = d6t_read_produced(f, buf, count, ppos,
+					file->f_flags & O_NONBLOCK);
+		if (ret != -ENOENT)
+			return ret;
+	}
+
+	if (file->f_flags & O_NONBLOCK)
+		return d6t_read_nonblock(f, buf, count, ppos);
+
 	mutex_lock(&d6t_data->lock);
 
-	if (d6t_get_frame(d6t_client, d6t_data) < 0) {
+	// Cleared by another file since the check above
+	if (!d6t_data->d6t_info) {
 		mutex_unlock(&d6t_data->lock);
-		return -EIO;
+		return -EINVAL;
 	}
 
-	if (d6t_checkPEC(d6t_client, d6t_data)) {
+	ret = d6t_get_new_frame(d6t_data);
+	if (ret == -ENOENT) {
+		mutex_unlock(&d6t_data->lock);
+		goto retry;
+	}
+	if (ret < 0) {
+		mutex_unlock(&d6t_data->lock);
+		return ret;
+	}
+
+	if (d6t_checkPEC(d6t_data->client, d6t_data)) {
 		mutex_unlock(&d6t_data->lock);
 		return -EIO;
 	}
 
 	d6t_convert_u8_to_s16(d6t_data);
 
-	int ret = copy_to_user(buf, d6t_data->raw, d6t_data->n_raw_data * sizeof(u16));
+	f->seen_seq = d6t_data->raw_seq;
+	ret = d6t_emit(f, buf, count, ppos);
 	mutex_unlock(&d6t_data->lock);
-	if (ret) {
-		pr_err("D6T: Failed to copy data to user space\n");
-		return -EFAULT;
-	}
-	*ppos += d6t_data->n_raw_data * sizeof(u16);
-	pr_info("D6T: Read %zu bytes from device\n", d6t_data->n_raw_data * sizeof(u16));
-	return d6t_data->n_raw_data * sizeof(u16);
+	return ret;
 	}
 
-static int d6t_write(struct file *file, const char __user *buf, size_t count,
+static ssize_t d6t_read(struct file *file, char __user *buf, size_t count,
+		    loff_t *ppos)
+{
+	struct d6t_file *f = file->private_data;
+	u64 t0 = ktime_get_ns();
+	ssize_t ret = __d6t_read(file, buf, count, ppos);
+
+	if (ret) // EOF is not a frame
+		d6t_stats_call(&f->d6t_data->stats, ret, ktime_get_ns() - t0);
+	return ret;
+}
+
+/*
+ * Legacy register write: a u16 with the register in the high byte and
+ * the value in the low byte. Goes through the same checks and read-back
+ * as D6T_IOC_SET_CONFIG.
+ */
+static ssize_t d6t_write(struct file *file, const char __user *buf, size_t count,
 		     loff_t *ppos)
 {
-	if (!d6t_data || !d6t_data->d6t_info) {
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+	const struct d6t_info *info = READ_ONCE(d6t_data->d6t_info);
+	struct d6t_config cfg = { 0 };
+	u16 reg_val;
+	u8 command, value;
+	int ret;
+
+	if (!info) {
 		pr_err("D6T: Device not initialized\n");
 		return -EINVAL;
 	}
@@ -352,116 +877,453 @@ static int d6t_write(struct file *file, const char __user *buf, size_t count,
 	}
 
 	if (count != sizeof(u16)) {
-    pr_err("D6T: Invalid write size %zu\n", count);
-    return -EINVAL;
-}
-
-	u16 msg;
-	if (copy_from_user(&msg, buf, sizeof(u16))) {
-    	pr_err("D6T: Failed to copy data from user\n");
-    	return -EFAULT;
-	}	
-
-	u8 command = msg >> 8; // High byte is register address
-	u8 value = msg & 0xFF; // Low byte is value
+		pr_err("D6T: Invalid write size %zu\n", count);
+		return -EINVAL;
+	}
 
-	if (command != d6t_data->d6t_info->iir_avg_reg &&
-    	command != d6t_data->d6t_info->cycle_reg) {
-    	pr_err("D6T: Unsupported register address 0x%02X\n", command);
-    	return -EINVAL;
+	if (copy_from_user(&reg_val, buf, sizeof(u16))) {
+		pr_err("D6T: Failed to copy data from user\n");
+		return -EFAULT;
 	}
 
-	struct i2c_msg msg = {
-		.addr = d6t_client->addr,
-		.flags = 0,
-		.len = 2,
-		.buf = (u8[]){ command, value }
-	};
+	command = reg_val >> 8; // High byte is register address
+	value = reg_val & 0xFF; // Low byte is value
+
+	if (d6t_reg_supported(info->iir_avg_reg) &&
+	    command == (u8)info->iir_avg_reg) {
+		cfg.mask = D6T_CFG_IIR | D6T_CFG_AVG;
+		cfg.iir = value >> 4;
+		cfg.avg = value & 0x0F;
+	} else if (d6t_reg_supported(info->cycle_reg) &&
+		   command == (u8)info->cycle_reg) {
+		cfg.mask = D6T_CFG_CYCLE;
+		cfg.cycle_ms = value * info->cycle_unit_ms;
+	} else {
+		pr_err("D6T: Unsupported register address 0x%02X\n", command);
+		return -EINVAL;
+	}
 
-	int ret = i2c_transfer(d6t_client->adapter, &msg, 1);
+	ret = d6t_set_config(d6t_data, &cfg);
 	if (ret < 0) {
-		pr_err("D6T: I2C transfer failed: %d\n", ret);
+		pr_err("D6T: Writing register 0x%02X failed: %d\n", command, ret);
 		return ret;
 	}
 
-	if (ret != 1) {
-		pr_err("D6T: I2C transfer returned %d messages, expected 1\n", ret);
-		return -EIO;
-	}
-
 	pr_info("D6T: Wrote value 0x%02X to register 0x%02X\n", value, command);
 	return count; // Return number of bytes written
 }
 
-static int d6t_open(struct inode *inode, struct file *file){
-	pr_info("D6T: Device opened\n");
+// MMAP FRAME RING
+static int d6t_ring_alloc(struct d6t_data *d6t_data)
+{
+	struct d6t_ring_hdr *hdr;
+	u32 depth = clamp_t(u32, ring_depth, D6T_RING_MIN_DEPTH, D6T_RING_MAX_DEPTH);
+
+	d6t_data->ring_depth = depth;
+	d6t_data->ring_policy = ring_policy == D6T_RING_DROP ? D6T_RING_DROP :
+							       D6T_RING_OVERWRITE;
+	d6t_data->ring_slot_size = ALIGN(sizeof(struct d6t_frame_hdr) +
+					 d6t_data->n_raw_data * sizeof(s16), 64);
+	d6t_data->ring_size = PAGE_ALIGN(PAGE_SIZE +
+					 depth * d6t_data->ring_slot_size);
+	d6t_data->ring_head = 0;
+	d6t_data->ring_dropped = 0;
+
+	// Zeroed, so every slot starts with seq == 0 (empty)
+	d6t_data->ring = vmalloc_user(d6t_data->ring_size);
+	if (!d6t_data->ring)
+		return -ENOMEM;
+
+	hdr = d6t_data->ring;
+	hdr->magic = D6T_RING_MAGIC;
+	hdr->version = D6T_RING_VERSION;
+	hdr->depth = depth;
+	hdr->policy = d6t_data->ring_policy;
+	hdr->slot_size = d6t_data->ring_slot_size;
+	hdr->data_offset = PAGE_SIZE;
+	hdr->n_raw_data = d6t_data->n_raw_data;
+	hdr->tail = 1;
 	return 0;
 }
 
-static int d6t_release(struct inode *inode, struct file *file){
-	pr_info("D6T: Device released\n");
+/*
+ * Publish d6t_data->raw as the next ring frame. Caller holds d6t_data->lock.
+ * Everything in the mapping is user-writable, so only the kernel copies of
+ * head/policy/dropped and the sanitized tail are trusted.
+ */
+static void d6t_ring_push(struct d6t_data *d6t_data, u32 pec_status)
+{
+	struct d6t_ring_hdr *hdr = d6t_data->ring;
+	struct d6t_frame_hdr *fh;
+	u64 seq = d6t_data->ring_head + 1;
+	u64 tail;
+	u32 idx;
+
+	if (d6t_data->ring_policy == D6T_RING_DROP) {
+		tail = READ_ONCE(hdr->tail);
+		if (tail <= seq && seq - tail >= d6t_data->ring_depth) {
+			WRITE_ONCE(hdr->dropped, ++d6t_data->ring_dropped);
+			return;
+		}
+	}
+
+	div_u64_rem(seq - 1, d6t_data->ring_depth, &idx);
+	fh = d6t_data->ring + PAGE_SIZE + idx * d6t_data->ring_slot_size;
+
+	WRITE_ONCE(fh->seq, 0);
+	smp_wmb(); // Mark the slot busy before touching its contents
+	fh->timestamp_ns = ktime_get_ns();
+	fh->pec_status = pec_status;
+	fh->len = d6t_data->n_raw_data * sizeof(s16);
+	memcpy(fh + 1, d6t_data->raw, fh->len);
+	smp_wmb(); // Contents visible before the slot is marked valid
+	WRITE_ONCE(fh->seq, seq);
+	smp_wmb();
+	d6t_data->ring_head = seq;
+	WRITE_ONCE(hdr->head, seq);
+	wake_up_interruptible(&d6t_data->frame_wq);
+}
+
+static int d6t_producer_thread(void *arg)
+{
+	struct d6t_data *d6t_data = arg;
+	struct d6t_cadence *c = &d6t_data->cadence;
+	u64 t, due;
+
+	while (!kthread_should_stop()) {
+		mutex_lock(&d6t_data->lock);
+		t = ktime_get_ns();
+		// client goes NULL just before d6t_remove() stops the thread
+		if (!d6t_data->client ||
+		    d6t_get_frame(d6t_data->client, d6t_data)) {
+			d6t_cadence_failed(c, t);
+		} else if (d6t_cadence_frame(c, t, d6t_data->buf,
+					     d6t_data->n_read, &d6t_data->stats)) {
+			// Frames failing PEC are still stored, flagged for readers
+			u32 pec = d6t_checkPEC(d6t_data->client, d6t_data) ?
+					  D6T_PEC_FAIL :
+					  D6T_PEC_OK;
+
+			d6t_convert_u8_to_s16(d6t_data);
+			d6t_data->raw_pec = pec;
+			d6t_ring_push(d6t_data, pec);
+			// read() follows raw_seq, also when the ring dropped it
+			wake_up_interruptible(&d6t_data->frame_wq);
+		}
+		// A duplicate is not pushed, the frame is read again shortly
+		due = c->next_ns;
+		mutex_unlock(&d6t_data->lock);
+
+		d6t_cadence_sleep_kthread(due);
+	}
 	return 0;
 }
 
+// The producer runs only while at least one mapping of the ring exists
+static void d6t_vma_open(struct vm_area_struct *vma)
+{
+	struct d6t_data *d6t_data = vma->vm_private_data;
+	struct task_struct *task;
 
-/* ===================== PROBE / REMOVE ======================== */
-static int d6t_probe(struct i2c_client *client)
+	bool gone;
+
+	kref_get(&d6t_data->ref);
+	mutex_lock(&d6t_data->ring_lock);
+	// A mapping kept (or forked) after remove gets no frames
+	mutex_lock(&d6t_data->lock);
+	gone = !d6t_data->client;
+	mutex_unlock(&d6t_data->lock);
+	if (d6t_data->map_count++ == 0 && !gone) {
+		task = kthread_run(d6t_producer_thread, d6t_data, "d6t-ring/%d",
+				   d6t_data->minor);
+		if (IS_ERR(task))
+			pr_err("D6T: Failed to start ring producer: %ld\n",
+			       PTR_ERR(task));
+		else
+			d6t_data->producer = task;
+	}
+	mutex_unlock(&d6t_data->ring_lock);
+}
+
+static void d6t_vma_close(struct vm_area_struct *vma)
+{
+	struct d6t_data *d6t_data = vma->vm_private_data;
+
+	mutex_lock(&d6t_data->ring_lock);
+	if (--d6t_data->map_count == 0 && d6t_data->producer) {
+		kthread_stop(d6t_data->producer);
+		d6t_data->producer = NULL;
+		wake_up_interruptible(&d6t_data->frame_wq);
+	}
+	mutex_unlock(&d6t_data->ring_lock);
+	kref_put(&d6t_data->ref, d6t_data_release);
+}
+
+static const struct vm_operations_struct d6t_vm_ops = {
+	.open = d6t_vma_open,
+	.close = d6t_vma_close,
+};
+
+static int d6t_mmap(struct file *file, struct vm_area_struct *vma)
 {
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
 	int ret;
-	d6t_client = client;
 
-	ret = alloc_chrdev_region(&d6t_dev_num, 0, 1, DRIVER_NAME);
-	if (ret < 0)
+	if (!d6t_data || !d6t_data->d6t_info) {
+		pr_err("D6T: Device not initialized\n");
+		return -EINVAL;
+	}
+
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	mutex_lock(&d6t_data->ring_lock);
+	if (!d6t_data->ring || vma->vm_pgoff ||
+	    size > d6t_data->ring_size) {
+		mutex_unlock(&d6t_data->ring_lock);
+		return -EINVAL;
+	}
+	mutex_lock(&d6t_data->lock);
+	ret = d6t_data->client ? 0 : -ENODEV;
+	mutex_unlock(&d6t_data->lock);
+	if (ret) {
+		mutex_unlock(&d6t_data->ring_lock);
+		return ret;
+	}
+	ret = remap_vmalloc_range(vma, d6t_data->ring, 0);
+	mutex_unlock(&d6t_data->ring_lock);
+	if (ret)
 		return ret;
 
-	// Initialize cdev
-	cdev_init(&d6t_cdev, &d6t_fops);
-	ret = cdev_add(&d6t_cdev, d6t_dev_num, 1);
-	if (ret < 0)
-		goto unregister_region;
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	vma->vm_ops = &d6t_vm_ops;
+	vma->vm_private_data = d6t_data;
+	d6t_vma_open(vma);
+	return 0;
+}
 
-	// Create device class
-	d6t_class = class_create(THIS_MODULE, "d6t_class");
-	if (IS_ERR(d6t_class)) {
-		ret = PTR_ERR(d6t_class);
-		goto del_cdev;
+/*
+ * While the ring is fed, POLLIN means a frame at or after the reader's
+ * tail has been published, or one read() has not handed out yet.
+ * Otherwise a blocking read() always goes to the bus, so the device is
+ * always readable; an O_NONBLOCK file is readable once a background
+ * sample is ready, and polling starts one.
+ */
+static __poll_t d6t_poll(struct file *file, poll_table *wait)
+{
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+	struct d6t_ring_hdr *hdr;
+	__poll_t mask = EPOLLIN | EPOLLRDNORM;
+
+	if (!d6t_data || !d6t_data->d6t_info)
+		return EPOLLERR;
+
+	poll_wait(file, &d6t_data->frame_wq, wait);
+
+	mutex_lock(&d6t_data->ring_lock);
+	hdr = d6t_data->ring;
+	if (d6t_data->producer && hdr) {
+		// read() takes the producer's frames too, see d6t_read_produced()
+		if (d6t_data->ring_head < READ_ONCE(hdr->tail) &&
+		    (!READ_ONCE(d6t_data->raw_valid) ||
+		     READ_ONCE(d6t_data->raw_seq) == f->seen_seq))
+			mask = 0;
+	} else if ((file->f_flags & O_NONBLOCK) &&
+		   !READ_ONCE(d6t_data->sample_ready) &&
+		   !READ_ONCE(d6t_data->sample_err)) {
+		mask = 0;
+		schedule_work(&d6t_data->sample_work);
 	}
-	
-	// Create device node
-	if (!device_create(d6t_class, NULL, d6t_dev_num, NULL, DRIVER_NAME)) {
-		ret = -ENOMEM;
-		goto destroy_class;
+	mutex_unlock(&d6t_data->ring_lock);
+
+	return mask;
+}
+
+static int d6t_open(struct inode *inode, struct file *file){
+	struct d6t_data *d6t_data;
+	struct d6t_file *f;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	// Only take a reference while the sensor is still listed
+	mutex_lock(&d6t_idr_lock);
+	d6t_data = idr_find(&d6t_idr, iminor(inode));
+	if (d6t_data)
+		kref_get(&d6t_data->ref);
+	mutex_unlock(&d6t_idr_lock);
+	if (!d6t_data) {
+		kfree(f);
+		return -ENODEV;
 	}
 
+	mutex_lock(&d6t_data->lock);
+	d6t_data->open_count++;
+	mutex_unlock(&d6t_data->lock);
+
+	f->d6t_data = d6t_data;
+	f->format = D6T_FORMAT_RAW;
+	d6t_delta_init(&f->delta);
+	file->private_data = f;
+	pr_info("D6T: Device d6t%d opened\n", d6t_data->minor);
+	return 0;
+}
+
+static int d6t_fasync(int fd, struct file *file, int on)
+{
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+
+	return fasync_helper(fd, file, on, &d6t_data->async_queue);
+}
+
+static int d6t_release(struct inode *inode, struct file *file){
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+
+	pr_info("D6T: Device d6t%d released\n", d6t_data->minor);
+	d6t_fasync(-1, file, 0);
+	mutex_lock(&d6t_data->lock);
+	d6t_data->open_count--;
+	mutex_unlock(&d6t_data->lock);
+	kref_put(&d6t_data->ref, d6t_data_release);
+	d6t_delta_free(&f->delta);
+	kfree(f);
+	return 0;
+}
+
+
+/* ===================== SYSFS ======================== */
+// Message layout currently used for frame reads, see d6t_xfer.h
+static ssize_t xfer_strategy_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct d6t_data *d6t_data = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (d6t_data->d6t_info)
+		ret = sysfs_emit(buf, "%s %u\n", d6t_xfer_name(&d6t_data->xfer),
+				 d6t_data->xfer.chunk);
+	else
+		ret = sysfs_emit(buf, "none\n");
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+static DEVICE_ATTR_RO(xfer_strategy);
+
+// Sensor settings, read back from the sensor on every access
+D6T_CONFIG_ATTR(iir, D6T_CFG_IIR, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(avg, D6T_CFG_AVG, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(cycle_ms, D6T_CFG_CYCLE, d6t_get_config, d6t_set_config);
+
+static struct attribute *d6t_attrs[] = {
+	&dev_attr_xfer_strategy.attr,
+	&dev_attr_iir.attr,
+	&dev_attr_avg.attr,
+	&dev_attr_cycle_ms.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(d6t);
+
+/* ===================== PROBE / REMOVE ======================== */
+static int d6t_probe(struct i2c_client *client)
+{
+	struct d6t_data *d6t_data;
+	struct device *dev;
+	int ret;
+
 	// Allocate memory for d6t_data
 	d6t_data = kzalloc(sizeof(struct d6t_data), GFP_KERNEL);
 	if (!d6t_data) {
 		pr_err("D6T: Failed to allocate memory for d6t_data\n");
-		ret = -ENOMEM;
-		goto destroy_class;
+		return -ENOMEM;
 	}
+	d6t_data->client = client;
+	kref_init(&d6t_data->ref);
+	mutex_init(&d6t_data->lock);
+	mutex_init(&d6t_data->ring_lock);
+	init_waitqueue_head(&d6t_data->frame_wq);
+	INIT_WORK(&d6t_data->sample_work, d6t_sample_work);
 
 	//Get device model name from device tree or i2c id
 	if (client->dev.of_node) {
 		const char *model_name;
 		if (of_property_read_string(client->dev.of_node, "model", &model_name) == 0) {
+			mutex_lock(&d6t_data->ring_lock);
+			mutex_lock(&d6t_data->lock);
 			ret = ioctl_d6t_init(d6t_data, model_name);
-			if (ret < 0) {
-				kfree(d6t_data);
-				goto destroy_class;
-			}
+			mutex_unlock(&d6t_data->lock);
+			mutex_unlock(&d6t_data->ring_lock);
+			if (ret < 0)
+				goto free_data;
 		}
 	}
 
-	pr_info("D6T: %s probed successfully\n", client->name);
+	// Reserve a minor, published to open() once the node exists
+	mutex_lock(&d6t_idr_lock);
+	ret = idr_alloc(&d6t_idr, NULL, 0, D6T_MAX_DEVICES, GFP_KERNEL);
+	mutex_unlock(&d6t_idr_lock);
+	if (ret < 0) {
+		dev_err(&client->dev, "No free minor (max %d sensors)\n",
+			D6T_MAX_DEVICES);
+		goto clear_data;
+	}
+	d6t_data->minor = ret;
+
+	// Initialize cdev
+	d6t_data->cdev = cdev_alloc();
+	if (!d6t_data->cdev) {
+		ret = -ENOMEM;
+		goto free_minor;
+	}
+	d6t_data->cdev->ops = &d6t_fops;
+	d6t_data->cdev->owner = THIS_MODULE;
+	ret = cdev_add(d6t_data->cdev, d6t_dev_base + d6t_data->minor, 1);
+	if (ret < 0) {
+		kobject_put(&d6t_data->cdev->kobj);
+		goto free_minor;
+	}
+
+	// Create device node
+	dev = device_create_with_groups(d6t_class, &client->dev,
+					d6t_dev_base + d6t_data->minor, d6t_data,
+					d6t_groups, DRIVER_NAME "%d",
+					d6t_data->minor);
+	if (IS_ERR(dev)) {
+		ret = PTR_ERR(dev);
+		goto del_cdev;
+	}
+
+	d6t_stats_init(&d6t_data->stats, d6t_debugfs_root, dev_name(dev));
+
+	i2c_set_clientdata(client, d6t_data);
+	mutex_lock(&d6t_idr_lock);
+	idr_replace(&d6t_idr, d6t_data, d6t_data->minor);
+	mutex_unlock(&d6t_idr_lock);
+
+	pr_info("D6T: %s probed successfully as /dev/%s%d\n", client->name,
+		DRIVER_NAME, d6t_data->minor);
 	return 0;
 
-destroy_class:
-	class_destroy(d6t_class);
 del_cdev:
-	cdev_del(&d6t_cdev);
-unregister_region:
-	unregister_chrdev_region(d6t_dev_num, 1);
+	cdev_del(d6t_data->cdev);
+free_minor:
+	mutex_lock(&d6t_idr_lock);
+	idr_remove(&d6t_idr, d6t_data->minor);
+	mutex_unlock(&d6t_idr_lock);
+clear_data:
+	mutex_lock(&d6t_data->ring_lock);
+	mutex_lock(&d6t_data->lock);
+	if (d6t_data->d6t_info)
+		ioctl_d6t_clear(d6t_data);
+	mutex_unlock(&d6t_data->lock);
+	mutex_unlock(&d6t_data->ring_lock);
+free_data:
 	kfree(d6t_data);
 	return ret;
 }
@@ -469,11 +1331,31 @@ unregister_region:
 
 static void d6t_remove(struct i2c_client *client)
 {
-	ioctl_d6t_clear(d6t_data);
-	kfree(d6t_data);
-	device_destroy(d6t_class, d6t_dev_num);
-	class_destroy(d6t_class);
-	cdev_del(&d6t_cdev);
-	unregister_chrdev_region(d6t_dev_num, 1);
+	struct d6t_data *d6t_data = i2c_get_clientdata(client);
+
+	mutex_lock(&d6t_idr_lock);
+	idr_remove(&d6t_idr, d6t_data->minor);
+	mutex_unlock(&d6t_idr_lock);
+	d6t_stats_remove(&d6t_data->stats);
+	device_destroy(d6t_class, d6t_dev_base + d6t_data->minor);
+	cdev_del(d6t_data->cdev);
+
+	/*
+	 * A mapping can outlive the driver, the producer must not. client
+	 * goes NULL under ring_lock, so d6t_vma_open() cannot start a new
+	 * producer once this one is stopped. Open files and mappings keep
+	 * the memory until they go away.
+	 */
+	mutex_lock(&d6t_data->ring_lock);
+	mutex_lock(&d6t_data->lock);
+	d6t_data->client = NULL;
+	mutex_unlock(&d6t_data->lock);
+	if (d6t_data->producer) {
+		kthread_stop(d6t_data->producer);
+		d6t_data->producer = NULL;
+	}
+	mutex_unlock(&d6t_data->ring_lock);
+	wake_up_interruptible(&d6t_data->frame_wq);
+	kref_put(&d6t_data->ref, d6t_data_release);
 	dev_info(&client->dev, "%s removed\n", DRIVER_NAME);
 }
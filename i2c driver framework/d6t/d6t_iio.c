@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * IIO front end for Omron D6T series thermal sensors
+ *
+ * Copyright (C) 2025-26 by Duy Bach Nguyen
+ *
+ * Channels: in_temp_ambient (PTAT) and in_tempN_object for each pixel,
+ * raw values in sensor counts. in_temp_ambient_scale and the pixels'
+ * shared in_temp_scale are milli degC per count from d6t_info_tbl, the
+ * same factors as D6T_FORMAT_MILLI (100 on both models so far).
+ * The sensor has no data-ready line, so the triggered buffer is driven
+ * by any IIO trigger, e.g. iio-trig-hrtimer at the sensor cycle:
+ *
+ *   mkdir /sys/kernel/config/iio/triggers/hrtimer/d6t
+ *   echo 5 > /sys/bus/iio/devices/trigger0/sampling_frequency
+ *   iio_readdev -t d6t -s 100 d6t32l01a > frames.bin
+*/
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/of.h>
+#include <linux/property.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/bitmap.h>
+#include <linux/unaligned.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include "d6t_crc.h"
+#include "d6t_info.h"
+#include "d6t_xfer.h"
+
+#define DRIVER_NAME "d6t-iio"
+
+struct d6t_iio {
+	struct i2c_client *client;
+	const struct d6t_info *d6t_info;
+	struct mutex lock; // Serializes bus access and buf
+	u8 *buf; // Frame as read from the sensor, PEC included
+	u8 *scan; // Frame + aligned s64 timestamp for the buffer
+	u16 n_read; // Number of bytes to read
+	u16 n_raw_data; // PTAT + pixels
+	struct d6t_xfer xfer; // Frame read layout for this adapter
+};
+
+/* ================ BUS ACCESS ================ */
+static int d6t_iio_read_frame(struct d6t_iio *d6t)
+{
+	struct i2c_client *client = d6t->client;
+	u32 n = d6t->n_read - 1; // Last byte is CRC
+	u8 crc;
+	int ret;
+
+	ret = d6t_xfer_read(&d6t->xfer, d6t->buf);
+	if (ret)
+		return ret;
+
+	crc = d6t_crc8_byte(0, (client->addr << 1) | 1); // I2C Read address
+	crc = d6t_crc8(crc, d6t->buf, n);
+	if (crc != d6t->buf[n]) {
+		dev_dbg(&client->dev, "PEC check failed: calc=%02X get=%02X\n",
+			crc, d6t->buf[n]);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* ================ IIO ================ */
+static irqreturn_t d6t_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct d6t_iio *d6t = iio_priv(indio_dev);
+
+	mutex_lock(&d6t->lock);
+	if (!d6t_iio_read_frame(d6t)) {
+		// Sensor order and little-endian layout match the scan layout
+		memcpy(d6t->scan, d6t->buf, d6t->n_raw_data * sizeof(u16));
+		iio_push_to_buffers_with_timestamp(indio_dev, d6t->scan,
+						   pf->timestamp);
+	}
+	mutex_unlock(&d6t->lock);
+
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int d6t_iio_read_raw(struct iio_dev *indio_dev,
+			    struct iio_chan_spec const *chan, int *val,
+			    int *val2, long mask)
+{
+	struct d6t_iio *d6t = iio_priv(indio_dev);
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+
+		mutex_lock(&d6t->lock);
+		ret = d6t_iio_read_frame(d6t);
+		if (!ret)
+			*val = (s16)get_unaligned_le16(
+				&d6t->buf[2 * chan->scan_index]);
+		mutex_unlock(&d6t->lock);
+
+		iio_device_release_direct_mode(indio_dev);
+		return ret ? ret : IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SCALE:
+		// IIO wants milli degC, as D6T_FORMAT_MILLI, see d6t_temp.h
+		*val = chan->scan_index ? d6t->d6t_info->pixel_mdeg :
+					  d6t->d6t_info->ptat_mdeg;
+		return IIO_VAL_INT;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info d6t_iio_info = {
+	.read_raw = d6t_iio_read_raw,
+};
+
+/*
+ * PTAT, one channel per pixel, then the timestamp. scan_index doubles
+ * as the value index in the sensor frame.
+ */
+static int d6t_iio_setup_channels(struct iio_dev *indio_dev)
+{
+	struct d6t_iio *d6t = iio_priv(indio_dev);
+	struct device *dev = &d6t->client->dev;
+	struct iio_chan_spec *chans;
+	unsigned long *masks;
+	u16 n = d6t->n_raw_data;
+
+	chans = devm_kcalloc(dev, n + 1, sizeof(*chans), GFP_KERNEL);
+	if (!chans)
+		return -ENOMEM;
+
+	for (u16 i = 0; i < n; i++) {
+		chans[i].type = IIO_TEMP;
+		chans[i].modified = 1;
+		chans[i].info_mask_separate = BIT(IIO_CHAN_INFO_RAW);
+		chans[i].scan_index = i;
+		chans[i].scan_type.sign = 's';
+		chans[i].scan_type.realbits = 16;
+		chans[i].scan_type.storagebits = 16;
+		chans[i].scan_type.endianness = IIO_LE;
+
+		// PTAT may count in other steps than the pixels
+		if (i == 0) {
+			chans[i].channel2 = IIO_MOD_TEMP_AMBIENT;
+			chans[i].info_mask_separate |= BIT(IIO_CHAN_INFO_SCALE);
+		} else {
+			chans[i].channel2 = IIO_MOD_TEMP_OBJECT;
+			chans[i].info_mask_shared_by_type =
+				BIT(IIO_CHAN_INFO_SCALE);
+			chans[i].indexed = 1;
+			chans[i].channel = i - 1;
+		}
+	}
+	chans[n] = (struct iio_chan_spec)IIO_CHAN_SOFT_TIMESTAMP(n);
+
+	// Only whole frames are read, the IIO core demuxes channel subsets
+	masks = devm_bitmap_zalloc(dev,
+				   2 * BITS_TO_LONGS(n + 1) * BITS_PER_LONG,
+				   GFP_KERNEL);
+	if (!masks)
+		return -ENOMEM;
+	bitmap_set(masks, 0, n);
+
+	indio_dev->channels = chans;
+	indio_dev->num_channels = n + 1;
+	indio_dev->available_scan_masks = masks;
+	return 0;
+}
+
+/* ================ PROBE ================ */
+static int d6t_iio_probe(struct i2c_client *client)
+{
+	struct device *dev = &client->dev;
+	struct iio_dev *indio_dev;
+	struct d6t_iio *d6t;
+	const char *model_name;
+	int ret;
+
+	indio_dev = devm_iio_device_alloc(dev, sizeof(*d6t));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	d6t = iio_priv(indio_dev);
+	d6t->client = client;
+	mutex_init(&d6t->lock);
+
+	// DT "model" property wins, like in the char drivers
+	d6t->d6t_info = i2c_get_match_data(client);
+	if (!device_property_read_string(dev, "model", &model_name))
+		d6t->d6t_info = d6t_info_find(model_name);
+	if (!d6t->d6t_info)
+		return dev_err_probe(dev, -EINVAL, "Unsupported model\n");
+
+	d6t->n_read = N_READ(d6t->d6t_info->row, d6t->d6t_info->col);
+	d6t->n_raw_data =
+		N_PIXELS(d6t->d6t_info->row, d6t->d6t_info->col) + 1; // +1 for PTAT
+
+	ret = d6t_xfer_init(&d6t->xfer, client, d6t->d6t_info->command,
+			    d6t->n_read);
+	if (ret)
+		return dev_err_probe(dev, ret, "Adapter cannot do plain I2C\n");
+
+	d6t->buf = devm_kzalloc(dev, d6t->n_read, GFP_KERNEL);
+	d6t->scan = devm_kzalloc(dev,
+				 ALIGN(d6t->n_raw_data * sizeof(u16),
+				       sizeof(s64)) + sizeof(s64),
+				 GFP_KERNEL);
+	if (!d6t->buf || !d6t->scan)
+		return -ENOMEM;
+
+	ret = d6t_iio_setup_channels(indio_dev);
+	if (ret)
+		return ret;
+
+	indio_dev->name = d6t->d6t_info->model_name;
+	indio_dev->info = &d6t_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+
+	// kfifo-backed buffer, timestamp captured in the trigger top half
+	ret = devm_iio_triggered_buffer_setup(dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      d6t_iio_trigger_handler, NULL);
+	if (ret)
+		return dev_err_probe(dev, ret, "Failed to setup buffer\n");
+
+	ret = devm_iio_device_register(dev, indio_dev);
+	if (ret)
+		return dev_err_probe(dev, ret, "Failed to register iio device\n");
+
+	dev_info(dev, "%s IIO device registered, %s transfers\n",
+		 d6t->d6t_info->model_name, d6t_xfer_name(&d6t->xfer));
+	return 0;
+}
+
+/* ================ MATCHING ================ */
+static const struct of_device_id d6t_iio_of_match[] = {
+	{ .compatible = "omron,d6t", .data = &d6t_info_tbl[D6T_32L_01A] },
+	{ .compatible = "omron,d6t01a", .data = &d6t_info_tbl[D6T_01A] },
+	{ .compatible = "omron,d6t32l01a", .data = &d6t_info_tbl[D6T_32L_01A] },
+	{}
+};
+MODULE_DEVICE_TABLE(of, d6t_iio_of_match);
+
+static const struct i2c_device_id d6t_iio_id[] = {
+	{ "d6t01a", (kernel_ulong_t)&d6t_info_tbl[D6T_01A] },
+	{ "d6t32l01a", (kernel_ulong_t)&d6t_info_tbl[D6T_32L_01A] },
+	{}
+};
+MODULE_DEVICE_TABLE(i2c, d6t_iio_id);
+
+static struct i2c_driver d6t_iio_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.of_match_table = d6t_iio_of_match,
+	},
+	.probe = d6t_iio_probe,
+	.id_table = d6t_iio_id,
+};
+
+module_i2c_driver(d6t_iio_driver);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("NGUYEN DUY BACH");
+MODULE_DESCRIPTION("Omron D6T series thermal sensors IIO driver");
+MODULE_VERSION("1.0");
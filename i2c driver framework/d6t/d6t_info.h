@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_info.h - model table shared by the omron d6t drivers
+*/
+#ifndef _D6T_INFO_H
+#define _D6T_INFO_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include "d6t_uapi.h"
+
+#define N_PIXELS(row, col) ((row) * (col))
+#define N_READ(row, col) \
+	(2 * (1 + N_PIXELS(row, col)) + 1) // 2 bytes per pixel and PTAT + 1 byte for CRC
+
+#define NOT_SUPPORT 0xFF
+
+enum {
+	D6T_01A,
+	D6T_32L_01A,
+};
+
+struct d6t_info {
+	const char *model_name;
+	u8 command;
+	u8 row;
+	u8 col;
+	s8 status_reg;
+	s8 iir_avg_reg;
+	s8 cycle_reg;
+	u16 cycle_ms; // Default internal refresh period of the sensor
+
+	// Settings accepted by the registers above, see d6t_config.h
+	u8 iir_max; // Upper nibble of iir_avg_reg
+	u8 avg_max; // Lower nibble of iir_avg_reg
+	u16 cycle_unit_ms; // cycle_reg counts the period in this unit
+	u16 cycle_min_ms;
+	u16 cycle_max_ms;
+
+	// milli degC per sensor count, see d6t_temp.h
+	u16 ptat_mdeg;
+	u16 pixel_mdeg;
+};
+
+static const struct d6t_info d6t_info_tbl[] = {
+	[D6T_01A] = { "d6t01a", 0x4C, 1, 1, NOT_SUPPORT, NOT_SUPPORT,
+		      NOT_SUPPORT, 200, .ptat_mdeg = 100, .pixel_mdeg = 100 },
+	[D6T_32L_01A] = { "d6t32l01a", 0x4D, 32, 32, 0x00, 0x01, 0x02, 200,
+			  15, 15, 10, 100, 2000, 100, 100 },
+	/* Add more models here if needed */
+};
+
+/*
+@brief Look up a model by name
+@param name model name, e.g. "d6t32l01a"
+@return model info, or NULL if the model is unknown
+*/
+static inline const struct d6t_info *d6t_info_find(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(d6t_info_tbl); i++)
+		if (strcmp(name, d6t_info_tbl[i].model_name) == 0)
+			return &d6t_info_tbl[i];
+	return NULL;
+}
+
+/*
+@brief Fill the D6T_IOC_GET_INFO reply of a driver
+@param out reply
+@param info model, NULL if not known yet
+@param caps D6T_CAP_* of the driver
+@param format current read() format of the file
+*/
+static inline void d6t_info_fill(struct d6t_dev_info *out,
+				 const struct d6t_info *info, u32 caps,
+				 u32 format)
+{
+	memset(out, 0, sizeof(*out));
+	out->version = D6T_INFO_VERSION;
+	out->caps = caps;
+	out->format = format;
+	if (!info)
+		return;
+	out->n_raw_data = N_PIXELS(info->row, info->col) + 1; // +1 for PTAT
+	out->row = info->row;
+	out->col = info->col;
+	out->cycle_ms = info->cycle_ms;
+	strscpy(out->model, info->model_name, sizeof(out->model));
+}
+
+#endif /* _D6T_INFO_H */
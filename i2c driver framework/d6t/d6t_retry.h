@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_retry.h - retry policy for frame reads of the omron d6t drivers
+ *
+ * A failed transfer is retried after a short sleep that doubles on every
+ * retry, so a single glitch costs about a millisecond instead of a whole
+ * sensor cycle. When recover_after frames in a row have failed, the bus
+ * is recovered with i2c_recover_bus() (clock pulses, then a STOP, if the
+ * adapter supports it). If the next frame fails too the sensor is taken
+ * as down: reads fail fast with -EIO for breaker_ms, then a single probe
+ * transfer decides whether to resume or to wait another breaker_ms.
+ *
+ * Driver side, with the bus lock held:
+ *
+ *	ret = d6t_retry_begin(&r, &pol, &stats);
+ *	if (ret)
+ *		return ret;
+ *	for (n = 1;; n++) {
+ *		ret = d6t_xfer_read(&xfer, buf);
+ *		if (!ret || !d6t_retry_again(&r, &pol, n, &stats))
+ *			break;
+ *	}
+ *	d6t_retry_end(&r, &pol, &xfer, ret, &stats);
+*/
+#ifndef _D6T_RETRY_H
+#define _D6T_RETRY_H
+
+#include <linux/kernel.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/timekeeping.h>
+#include <linux/i2c.h>
+#include "d6t_xfer.h"
+#include "d6t_stats.h"
+
+struct d6t_retry_policy {
+	unsigned int tries; // Transfers per frame, the first one included
+	unsigned int backoff_us; // Sleep before the first retry, doubled after
+	unsigned int backoff_max_us;
+	unsigned int recover_after; // Failed frames before bus recovery, 0: never
+	unsigned int breaker_ms; // How long to fail fast once the sensor is down
+};
+
+#define D6T_RETRY_POLICY_DEFAULT                                               \
+	{                                                                      \
+		.tries = 4, .backoff_us = 1000, .backoff_max_us = 50000,       \
+		.recover_after = 3, .breaker_ms = 2000,                        \
+	}
+
+/*
+ * Declare the policy knobs of a driver, writable at run time under
+ * /sys/module/<driver>/parameters.
+ */
+#define D6T_RETRY_MODULE_PARAMS(pol)                                           \
+	module_param_named(retry_tries, (pol).tries, uint, 0644);              \
+	MODULE_PARM_DESC(retry_tries, "Transfers per frame read (default 4)"); \
+	module_param_named(retry_backoff_us, (pol).backoff_us, uint, 0644);    \
+	MODULE_PARM_DESC(retry_backoff_us,                                     \
+			 "Sleep before the first retry, doubled after each");  \
+	module_param_named(retry_backoff_max_us, (pol).backoff_max_us, uint,   \
+			   0644);                                              \
+	MODULE_PARM_DESC(retry_backoff_max_us, "Longest sleep between retries"); \
+	module_param_named(recover_after, (pol).recover_after, uint, 0644);    \
+	MODULE_PARM_DESC(recover_after,                                        \
+			 "Failed frames in a row before bus recovery, 0 = never"); \
+	module_param_named(breaker_ms, (pol).breaker_ms, uint, 0644);          \
+	MODULE_PARM_DESC(breaker_ms,                                           \
+			 "Fail fast for this long when recovery did not help")
+
+// Per sensor state, under the driver's bus lock
+struct d6t_retry {
+	u32 streak; // Frames failed in a row
+	u32 backoff_us; // Sleep before the next retry of this frame
+	bool probing; // Single transfer after breaker_ms, no retries
+	unsigned long open_until; // jiffies, fail fast until then
+	u64 down_since_ns; // First failure of the streak
+};
+
+static inline bool d6t_retry_down(const struct d6t_retry *r,
+				  const struct d6t_retry_policy *pol)
+{
+	return pol->recover_after && r->streak > pol->recover_after;
+}
+
+/*
+@brief Start a frame read
+@return 0, or -EIO while the sensor is taken as down
+*/
+static inline int d6t_retry_begin(struct d6t_retry *r,
+				  const struct d6t_retry_policy *pol,
+				  struct d6t_stats *stats)
+{
+	r->probing = d6t_retry_down(r, pol);
+	if (r->probing && time_before(jiffies, r->open_until)) {
+		d6t_stats_inc(stats, D6T_STAT_FAST_FAILS);
+		return -EIO;
+	}
+	r->backoff_us = pol->backoff_us;
+	return 0;
+}
+
+/*
+@brief Sleep before retrying a failed transfer
+@param done transfers made so far for this frame
+@return true if the transfer should be made again
+*/
+static inline bool d6t_retry_again(struct d6t_retry *r,
+				   const struct d6t_retry_policy *pol,
+				   unsigned int done, struct d6t_stats *stats)
+{
+	if (r->probing || done >= pol->tries)
+		return false;
+
+	d6t_stats_inc(stats, D6T_STAT_RETRIES);
+	if (r->backoff_us)
+		fsleep(r->backoff_us);
+	r->backoff_us = min(r->backoff_us * 2, pol->backoff_max_us);
+	return true;
+}
+
+/*
+@brief Account a finished frame read, recover the bus or fail fast
+@param ret result of the last transfer
+*/
+static inline void d6t_retry_end(struct d6t_retry *r,
+				 const struct d6t_retry_policy *pol,
+				 struct d6t_xfer *x, int ret,
+				 struct d6t_stats *stats)
+{
+	struct device *dev = &x->client->dev;
+	u64 now = ktime_get_ns();
+	int rec;
+
+	if (!ret) {
+		if (!r->streak)
+			return;
+		if (d6t_retry_down(r, pol))
+			dev_info(dev, "Sensor back after %llu ms\n",
+				 div_u64(now - r->down_since_ns, NSEC_PER_MSEC));
+		d6t_stats_inc(stats, D6T_STAT_OUTAGES);
+		d6t_stats_add(stats, D6T_STAT_DOWN_US,
+			      div_u64(now - r->down_since_ns, NSEC_PER_USEC));
+		r->streak = 0;
+		return;
+	}
+
+	if (!r->streak++)
+		r->down_since_ns = now;
+	if (!pol->recover_after || r->streak < pol->recover_after)
+		return;
+
+	if (r->streak == pol->recover_after) {
+		// No other client may talk while SCL is being clocked out
+		i2c_lock_bus(x->client->adapter, I2C_LOCK_ROOT_ADAPTER);
+		rec = i2c_recover_bus(x->client->adapter);
+		i2c_unlock_bus(x->client->adapter, I2C_LOCK_ROOT_ADAPTER);
+		d6t_stats_inc(stats, D6T_STAT_BUS_RECOVERIES);
+		d6t_stats_add(stats, D6T_STAT_RECOVERY_US,
+			      div_u64(ktime_get_ns() - now, NSEC_PER_USEC));
+		dev_warn(dev, "%u frames failed (%d), bus recovery: %d\n",
+			 r->streak, ret, rec);
+		return;
+	}
+
+	r->open_until = jiffies + msecs_to_jiffies(pol->breaker_ms);
+	if (!r->probing) {
+		d6t_stats_inc(stats, D6T_STAT_BREAKER_TRIPS);
+		dev_warn(dev, "Sensor not responding (%d), failing fast for %u ms\n",
+			 ret, pol->breaker_ms);
+	}
+}
+
+#endif /* _D6T_RETRY_H */
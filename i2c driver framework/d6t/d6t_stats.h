@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_stats.h - per sensor counters of the omron d6t drivers
+ *
+ * Counters and two latency histograms, one for the I2C frame transfer
+ * and one for a whole read()/ioctl() that returns a frame. Histogram
+ * buckets are powers of two in microseconds. Everything is shown in
+ *
+ *   /sys/kernel/debug/d6t/<node>/stats
+ *
+ * and writing anything to that file clears it. Updates are atomic, so
+ * they need no lock and may come from the acquisition threads and from
+ * readers at the same time.
+*/
+#ifndef _D6T_STATS_H
+#define _D6T_STATS_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+
+#define D6T_HIST_BUCKETS 21 // [0, 2) us .. [2^20 us, inf), about 1 s
+
+enum d6t_stat {
+	D6T_STAT_XFERS, // Frame transfers started
+	D6T_STAT_XFER_ERRORS, // Transfers the adapter failed
+	D6T_STAT_RETRIES, // Transfers repeated after an error
+	D6T_STAT_BUS_RECOVERIES, // i2c_recover_bus() calls, see d6t_retry.h
+	D6T_STAT_RECOVERY_US, // Time spent in i2c_recover_bus()
+	D6T_STAT_BREAKER_TRIPS, // Times reads started failing fast
+	D6T_STAT_FAST_FAILS, // Reads refused while failing fast
+	D6T_STAT_OUTAGES, // Failure streaks that ended in a good frame
+	D6T_STAT_DOWN_US, // Their total length, first failure to good frame
+	D6T_STAT_PEC_FAIL, // Frames with a bad PEC byte
+	D6T_STAT_DUPLICATES, // Reads that got the previous frame again
+	D6T_STAT_EIO, // read()/ioctl() calls returning -EIO
+	D6T_STAT_EFAULT, // read()/ioctl() calls returning -EFAULT
+	D6T_STAT_BYTES_IN, // Bytes read from the bus
+	D6T_STAT_BYTES_OUT, // Bytes copied to userspace
+	D6T_STAT_NR,
+};
+
+static const char *const d6t_stat_names[D6T_STAT_NR] = {
+	[D6T_STAT_XFERS] = "xfers",
+	[D6T_STAT_XFER_ERRORS] = "xfer_errors",
+	[D6T_STAT_RETRIES] = "retries",
+	[D6T_STAT_BUS_RECOVERIES] = "bus_recoveries",
+	[D6T_STAT_RECOVERY_US] = "recovery_us",
+	[D6T_STAT_BREAKER_TRIPS] = "breaker_trips",
+	[D6T_STAT_FAST_FAILS] = "fast_fails",
+	[D6T_STAT_OUTAGES] = "outages",
+	[D6T_STAT_DOWN_US] = "down_us",
+	[D6T_STAT_PEC_FAIL] = "pec_fail",
+	[D6T_STAT_DUPLICATES] = "duplicates",
+	[D6T_STAT_EIO] = "eio",
+	[D6T_STAT_EFAULT] = "efault",
+	[D6T_STAT_BYTES_IN] = "bytes_in",
+	[D6T_STAT_BYTES_OUT] = "bytes_out",
+};
+
+struct d6t_hist {
+	atomic_long_t bucket[D6T_HIST_BUCKETS];
+	atomic64_t sum_ns;
+};
+
+struct d6t_stats {
+	atomic64_t cnt[D6T_STAT_NR];
+	struct d6t_hist xfer; // I2C frame transfer
+	struct d6t_hist call; // read()/ioctl() returning a frame
+	struct dentry *dir;
+};
+
+static inline void d6t_stats_add(struct d6t_stats *s, enum d6t_stat stat, u64 v)
+{
+	atomic64_add(v, &s->cnt[stat]);
+}
+
+static inline void d6t_stats_inc(struct d6t_stats *s, enum d6t_stat stat)
+{
+	atomic64_inc(&s->cnt[stat]);
+}
+
+static inline void d6t_hist_add(struct d6t_hist *h, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	u32 i = us ? min_t(u32, ilog2(us), D6T_HIST_BUCKETS - 1) : 0;
+
+	atomic_long_inc(&h->bucket[i]);
+	atomic64_add(ns, &h->sum_ns);
+}
+
+// One frame transfer of @len bytes that took @ns and returned @ret
+static inline void d6t_stats_xfer(struct d6t_stats *s, u32 len, int ret, u64 ns)
+{
+	d6t_stats_inc(s, D6T_STAT_XFERS);
+	if (ret < 0)
+		d6t_stats_inc(s, D6T_STAT_XFER_ERRORS);
+	else
+		d6t_stats_add(s, D6T_STAT_BYTES_IN, len);
+	d6t_hist_add(&s->xfer, ns);
+}
+
+/*
+ * A read()/ioctl() that returned @ret after @ns. -EAGAIN is not a frame
+ * and is left out, it would only fill the lowest bucket.
+ */
+static inline void d6t_stats_call(struct d6t_stats *s, long ret, u64 ns)
+{
+	if (ret == -EAGAIN)
+		return;
+	if (ret == -EIO)
+		d6t_stats_inc(s, D6T_STAT_EIO);
+	else if (ret == -EFAULT)
+		d6t_stats_inc(s, D6T_STAT_EFAULT);
+	d6t_hist_add(&s->call, ns);
+}
+
+static inline void d6t_stats_reset(struct d6t_stats *s)
+{
+	int i;
+
+	for (i = 0; i < D6T_STAT_NR; i++)
+		atomic64_set(&s->cnt[i], 0);
+	for (i = 0; i < D6T_HIST_BUCKETS; i++) {
+		atomic_long_set(&s->xfer.bucket[i], 0);
+		atomic_long_set(&s->call.bucket[i], 0);
+	}
+	atomic64_set(&s->xfer.sum_ns, 0);
+	atomic64_set(&s->call.sum_ns, 0);
+}
+
+static inline void d6t_hist_show(struct seq_file *m, const char *name,
+				 struct d6t_hist *h)
+{
+	unsigned long n, total = 0;
+	int i;
+
+	for (i = 0; i < D6T_HIST_BUCKETS; i++)
+		total += atomic_long_read(&h->bucket[i]);
+	seq_printf(m, "\n%s_us: count %lu avg %llu\n", name, total,
+		   total ? div64_u64(atomic64_read(&h->sum_ns),
+				     (u64)total * NSEC_PER_USEC) : 0);
+
+	for (i = 0; i < D6T_HIST_BUCKETS; i++) {
+		n = atomic_long_read(&h->bucket[i]);
+		if (!n)
+			continue;
+		if (i == D6T_HIST_BUCKETS - 1)
+			seq_printf(m, "  [%8lu, inf) %lu\n", i ? 1UL << i : 0, n);
+		else
+			seq_printf(m, "  [%8lu, %8lu) %lu\n", i ? 1UL << i : 0,
+				   2UL << i, n);
+	}
+}
+
+static int d6t_stats_show(struct seq_file *m, void *unused)
+{
+	struct d6t_stats *s = m->private;
+	int i;
+
+	for (i = 0; i < D6T_STAT_NR; i++)
+		seq_printf(m, "%-15s %llu\n", d6t_stat_names[i],
+			   (u64)atomic64_read(&s->cnt[i]));
+	d6t_hist_show(m, "xfer", &s->xfer);
+	d6t_hist_show(m, "call", &s->call);
+	return 0;
+}
+
+static int d6t_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, d6t_stats_show, inode->i_private);
+}
+
+static ssize_t d6t_stats_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+
+	d6t_stats_reset(m->private);
+	return count;
+}
+
+static const struct file_operations d6t_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = d6t_stats_open,
+	.read = seq_read,
+	.write = d6t_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Create <root>/<name>/stats. debugfs failures are not fatal and are
+ * not reported, the sensor works the same without its counters.
+ */
+static inline void d6t_stats_init(struct d6t_stats *s, struct dentry *root,
+				  const char *name)
+{
+	d6t_stats_reset(s);
+	s->dir = debugfs_create_dir(name, root);
+	debugfs_create_file("stats", 0600, s->dir, s, &d6t_stats_fops);
+}
+
+// Waits for stats readers to leave, call before the counters are freed
+static inline void d6t_stats_remove(struct d6t_stats *s)
+{
+	debugfs_remove(s->dir);
+	s->dir = NULL;
+}
+
+#endif /* _D6T_STATS_H */
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Emulated Omron D6T sensor on a software I2C adapter
+ *
+ * Copyright (C) 2025-26 by Duy Bach Nguyen
+ *
+ * Like i2c-stub, the module registers its own adapter. One sensor of the
+ * chosen model answers at chip_addr and is instantiated on load, so the
+ * d6t driver that is loaded binds to it and runs without the hardware:
+ *
+ *   insmod d6t32l.ko
+ *   insmod d6t_stub.ko model=d6t32l01a scene=2 bus_khz=400
+ *
+ * The client is named after the model. d6t_full, d6tioctl and d6t_iio
+ * match both names, d6t32l only d6t32l01a.
+ *
+ * Writing the frame command (0x4C / 0x4D) latches one frame of the
+ * synthetic scene. Reads that follow return it with a valid PEC, also
+ * across messages and transfers, so every layout of d6t_xfer.h works.
+ * [reg, val] writes set the IIR/AVG and cycle registers; [reg] and a
+ * read return them. The scene moves on once per sensor cycle, as set in
+ * the cycle register, reading faster gives the same frame again as on
+ * the real part.
+ *
+ * Runtime knobs in /sys/module/d6t_stub/parameters:
+ *   scene       0 flat, 1 gradient, 2 moving hot spot, 3 noise
+ *   latency_us  added to every transfer that reads frame data
+ *   bus_khz     charge 9 SCL clocks per byte at this rate, 0 for none
+ *   nack_rate   per mille of transfers failing with -ENXIO
+ *   crc_rate    per mille of frames sent with a corrupted PEC
+*/
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/unaligned.h>
+#include "d6t_crc.h"
+#include "d6t_info.h"
+
+#define DRIVER_NAME "d6t-stub"
+
+enum {
+	D6T_STUB_FLAT,
+	D6T_STUB_GRADIENT,
+	D6T_STUB_HOTSPOT,
+	D6T_STUB_NOISE,
+};
+
+static char *model = "d6t32l01a";
+module_param(model, charp, 0444);
+MODULE_PARM_DESC(model, "Emulated model, d6t01a or d6t32l01a");
+
+static unsigned short chip_addr = 0x0a;
+module_param(chip_addr, ushort, 0444);
+MODULE_PARM_DESC(chip_addr, "I2C address of the emulated sensor");
+
+static bool instantiate = true;
+module_param(instantiate, bool, 0444);
+MODULE_PARM_DESC(instantiate, "Create the i2c client on load");
+
+static unsigned int scene = D6T_STUB_HOTSPOT;
+module_param(scene, uint, 0644);
+MODULE_PARM_DESC(scene, "0 flat, 1 gradient, 2 moving hot spot, 3 noise");
+
+static unsigned int cycle_ms;
+module_param(cycle_ms, uint, 0644);
+MODULE_PARM_DESC(cycle_ms, "Scene refresh period, 0 to follow the cycle register");
+
+static unsigned int latency_us;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us, "Extra delay of transfers that read frame data");
+
+static unsigned int bus_khz;
+module_param(bus_khz, uint, 0644);
+MODULE_PARM_DESC(bus_khz, "Emulated SCL rate for transfer time, 0 for none");
+
+static unsigned int nack_rate;
+module_param(nack_rate, uint, 0644);
+MODULE_PARM_DESC(nack_rate, "Transfers NACKed, per mille");
+
+static unsigned int crc_rate;
+module_param(crc_rate, uint, 0644);
+MODULE_PARM_DESC(crc_rate, "Frames sent with a bad PEC, per mille");
+
+// Adapter limits, to exercise the transfer layouts of d6t_xfer.h
+static unsigned short max_read_len;
+module_param(max_read_len, ushort, 0444);
+MODULE_PARM_DESC(max_read_len, "Longest read message accepted, 0 for no limit");
+
+static bool no_rep_start;
+module_param(no_rep_start, bool, 0444);
+MODULE_PARM_DESC(no_rep_start, "Reject transfers with a repeated START");
+
+static bool nostart;
+module_param(nostart, bool, 0444);
+MODULE_PARM_DESC(nostart, "Advertise I2C_FUNC_NOSTART");
+
+struct d6t_stub {
+	struct i2c_adapter adap;
+	struct i2c_client *client;
+	const struct d6t_info *d6t_info;
+	ktime_t start; // Scene time 0
+
+	// Serialized by the adapter bus lock
+	u8 *frame; // Latched frame, PEC included
+	u16 n_read;
+	u16 off; // Next frame byte to send
+	u8 ptr; // Last command or register written
+	u8 regs[256];
+};
+
+static struct d6t_stub d6t_stub;
+
+static struct i2c_adapter_quirks d6t_stub_quirks;
+
+static bool d6t_stub_chance(unsigned int rate)
+{
+	return rate && get_random_u32_below(1000) < rate;
+}
+
+/* ================ SCENE ================ */
+static unsigned int d6t_stub_tri(u64 t, unsigned int n)
+{
+	unsigned int pos = n ? do_div(t, 2 * n) : 0;
+
+	return pos < n ? pos : 2 * n - pos;
+}
+
+// Pixel (x, y) of sensor frame t, 0.1 degC
+static s16 d6t_stub_pixel(const struct d6t_info *info, u64 t, int x, int y)
+{
+	int cx, cy, d2;
+	u32 h;
+
+	switch (READ_ONCE(scene)) {
+	case D6T_STUB_FLAT:
+		return 250;
+	case D6T_STUB_GRADIENT:
+		return 200 + 5 * (x + y);
+	case D6T_STUB_HOTSPOT:
+		// Person-sized blob bouncing over a 23 degC background
+		cx = d6t_stub_tri(t, info->col);
+		cy = d6t_stub_tri(t / 2 + info->row / 2, info->row);
+		d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+		return 230 + (d2 < 50 ? 250 - 5 * d2 : 0);
+	default:
+		// Same t, same noise: repeated reads within a cycle match
+		h = (x * 73856093u) ^ (y * 19349663u) ^ ((u32)t * 83492791u);
+		return 250 + (int)(h % 41) - 20;
+	}
+}
+
+// Sensor cycle in ms, see d6t_config.h for the register layout
+static unsigned int d6t_stub_cycle_ms(const struct d6t_stub *s)
+{
+	const struct d6t_info *info = s->d6t_info;
+	u8 val;
+
+	if (READ_ONCE(cycle_ms))
+		return READ_ONCE(cycle_ms);
+	if (info->cycle_reg == (s8)NOT_SUPPORT)
+		return info->cycle_ms;
+	val = s->regs[(u8)info->cycle_reg];
+	return val ? val * info->cycle_unit_ms : info->cycle_ms;
+}
+
+static void d6t_stub_latch(struct d6t_stub *s)
+{
+	const struct d6t_info *info = s->d6t_info;
+	unsigned int cyc = d6t_stub_cycle_ms(s);
+	u64 t = div_u64(ktime_ms_delta(ktime_get(), s->start), cyc);
+	u8 *p = s->frame;
+	u32 n = s->n_read - 1; // Last byte is PEC
+	u8 crc;
+
+	put_unaligned_le16(250 + (u16)(t & 3), p); // PTAT
+	p += 2;
+	for (int y = 0; y < info->row; y++)
+		for (int x = 0; x < info->col; x++, p += 2)
+			put_unaligned_le16(d6t_stub_pixel(info, t, x, y), p);
+
+	// Same PEC the drivers check: read address, then the frame
+	crc = d6t_crc8_byte(0, (chip_addr << 1) | 1);
+	crc = d6t_crc8(crc, s->frame, n);
+	if (d6t_stub_chance(READ_ONCE(crc_rate)))
+		crc ^= 0xff;
+	s->frame[n] = crc;
+	s->off = 0;
+}
+
+/* ================ BUS ================ */
+static bool d6t_stub_reg_valid(const struct d6t_info *info, u8 reg)
+{
+	s8 regs[] = { info->status_reg, info->iir_avg_reg, info->cycle_reg };
+
+	for (size_t i = 0; i < ARRAY_SIZE(regs); i++)
+		if (regs[i] != (s8)NOT_SUPPORT && (u8)regs[i] == reg)
+			return true;
+	return false;
+}
+
+static int d6t_stub_write(struct d6t_stub *s, const u8 *buf, u16 len)
+{
+	if (!len)
+		return 0; // Address probe
+
+	s->ptr = buf[0];
+	if (buf[0] == s->d6t_info->command) {
+		if (len > 1)
+			return -EIO;
+		d6t_stub_latch(s);
+		return 0;
+	}
+
+	if (!d6t_stub_reg_valid(s->d6t_info, buf[0]))
+		return -ENXIO; // NACK of an unknown register
+	if (len > 2)
+		return -EIO;
+	if (len == 2)
+		s->regs[buf[0]] = buf[1];
+	return 0;
+}
+
+static void d6t_stub_read(struct d6t_stub *s, u8 *buf, u16 len)
+{
+	u16 n;
+
+	if (s->ptr != s->d6t_info->command) {
+		for (u16 i = 0; i < len; i++)
+			buf[i] = s->regs[(u8)(s->ptr + i)];
+		return;
+	}
+
+	n = min_t(u16, len, s->n_read - s->off);
+	memcpy(buf, s->frame + s->off, n);
+	memset(buf + n, 0xff, len - n); // Past the frame SDA stays high
+	s->off += n;
+}
+
+static void d6t_stub_delay(unsigned int bytes, bool frame)
+{
+	unsigned int khz = READ_ONCE(bus_khz);
+	u64 us = frame ? READ_ONCE(latency_us) : 0;
+
+	if (khz)
+		us += div_u64((u64)bytes * 9 * 1000, khz);
+	if (us)
+		fsleep(us);
+}
+
+static int d6t_stub_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
+			 int num)
+{
+	struct d6t_stub *s = i2c_get_adapdata(adap);
+	unsigned int bytes = 0;
+	bool frame = false;
+	int ret;
+
+	if (d6t_stub_chance(READ_ONCE(nack_rate)))
+		return -ENXIO;
+
+	for (int i = 0; i < num; i++) {
+		struct i2c_msg *m = &msgs[i];
+
+		if (m->addr != chip_addr)
+			return -ENXIO;
+
+		bytes += m->len + !(m->flags & I2C_M_NOSTART); // + address
+		if (m->flags & I2C_M_RD) {
+			d6t_stub_read(s, m->buf, m->len);
+			frame |= s->ptr == s->d6t_info->command;
+		} else {
+			ret = d6t_stub_write(s, m->buf, m->len);
+			if (ret)
+				return ret;
+		}
+	}
+
+	d6t_stub_delay(bytes, frame);
+	return num;
+}
+
+static u32 d6t_stub_func(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL |
+	       (nostart ? I2C_FUNC_NOSTART : 0);
+}
+
+static const struct i2c_algorithm d6t_stub_algo = {
+	.master_xfer = d6t_stub_xfer,
+	.functionality = d6t_stub_func,
+};
+
+/* ================ MODULE ================ */
+static int __init d6t_stub_init(void)
+{
+	struct d6t_stub *s = &d6t_stub;
+	struct i2c_board_info board = { .addr = chip_addr };
+	int ret;
+
+	s->d6t_info = d6t_info_find(model);
+	if (!s->d6t_info) {
+		pr_err("%s: Unsupported model %s\n", DRIVER_NAME, model);
+		return -EINVAL;
+	}
+	if (chip_addr < 0x08 || chip_addr > 0x77) {
+		pr_err("%s: Invalid chip address 0x%02x\n", DRIVER_NAME,
+		       chip_addr);
+		return -EINVAL;
+	}
+
+	s->n_read = N_READ(s->d6t_info->row, s->d6t_info->col);
+	s->frame = kzalloc(s->n_read, GFP_KERNEL);
+	if (!s->frame)
+		return -ENOMEM;
+	s->ptr = s->d6t_info->command;
+	if (s->d6t_info->cycle_reg != (s8)NOT_SUPPORT)
+		s->regs[(u8)s->d6t_info->cycle_reg] =
+			s->d6t_info->cycle_ms / s->d6t_info->cycle_unit_ms;
+	s->start = ktime_get();
+	d6t_stub_latch(s);
+
+	if (max_read_len || no_rep_start) {
+		d6t_stub_quirks.max_read_len = max_read_len;
+		d6t_stub_quirks.flags = no_rep_start ? I2C_AQ_NO_REP_START : 0;
+		s->adap.quirks = &d6t_stub_quirks;
+	}
+	s->adap.owner = THIS_MODULE;
+	s->adap.algo = &d6t_stub_algo;
+	snprintf(s->adap.name, sizeof(s->adap.name), "D6T stub (%s)",
+		 s->d6t_info->model_name);
+	i2c_set_adapdata(&s->adap, s);
+
+	ret = i2c_add_adapter(&s->adap);
+	if (ret)
+		goto err_free;
+
+	if (instantiate) {
+		strscpy(board.type, s->d6t_info->model_name, sizeof(board.type));
+		s->client = i2c_new_client_device(&s->adap, &board);
+		if (IS_ERR(s->client)) {
+			ret = PTR_ERR(s->client);
+			s->client = NULL;
+			goto err_del;
+		}
+	}
+
+	pr_info("%s: %s at 0x%02x on %s\n", DRIVER_NAME,
+		s->d6t_info->model_name, chip_addr, dev_name(&s->adap.dev));
+	return 0;
+
+err_del:
+	i2c_del_adapter(&s->adap);
+err_free:
+	kfree(s->frame);
+	return ret;
+}
+
+static void __exit d6t_stub_exit(void)
+{
+	struct d6t_stub *s = &d6t_stub;
+
+	i2c_unregister_device(s->client);
+	i2c_del_adapter(&s->adap);
+	kfree(s->frame);
+}
+
+module_init(d6t_stub_init);
+module_exit(d6t_stub_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("NGUYEN DUY BACH");
+MODULE_DESCRIPTION("Emulated Omron D6T thermal sensor for testing");
+MODULE_VERSION("1.0");
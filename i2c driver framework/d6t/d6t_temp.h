@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_temp.h - fixed point temperatures of the omron d6t drivers
+ *
+ * Frames carry PTAT and pixels as signed little-endian 16 bit counts.
+ * How many milli degC one count is depends on the model and may differ
+ * between PTAT and pixels (ptat_mdeg, pixel_mdeg in d6t_info_tbl).
+ * D6T_FORMAT_DECI and D6T_FORMAT_MILLI hand out values in fixed units
+ * whatever the model, so readers need neither the table nor an FPU.
+*/
+#ifndef _D6T_TEMP_H
+#define _D6T_TEMP_H
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/unaligned.h>
+#include "d6t_info.h"
+#include "d6t_uapi.h"
+
+#define D6T_MDEG_PER_DECI 100
+
+// Frame bytes to sensor counts, PTAT first
+static inline void d6t_temp_counts(const u8 *buf, s16 *raw, u32 n)
+{
+	for (u32 i = 0; i < n; i++)
+		raw[i] = (s16)get_unaligned_le16(buf + 2 * i);
+}
+
+static inline bool d6t_temp_format(u32 format)
+{
+	return format == D6T_FORMAT_DECI || format == D6T_FORMAT_MILLI;
+}
+
+// Bytes of an n value frame in D6T_FORMAT_DECI or D6T_FORMAT_MILLI
+static inline size_t d6t_temp_size(u32 format, u32 n)
+{
+	return n * (format == D6T_FORMAT_MILLI ? sizeof(s32) : sizeof(s16));
+}
+
+/*
+@brief Scale sensor counts to D6T_FORMAT_DECI or D6T_FORMAT_MILLI
+@param raw n counts, PTAT first
+@param out d6t_temp_size() bytes
+@return bytes written to out
+*/
+static inline size_t d6t_temp_convert(const struct d6t_info *info, u32 format,
+				      const s16 *raw, void *out, u32 n)
+{
+	s32 *milli = out;
+	s16 *deci = out;
+	s32 v;
+
+	if (format == D6T_FORMAT_MILLI) {
+		milli[0] = raw[0] * info->ptat_mdeg;
+		for (u32 i = 1; i < n; i++)
+			milli[i] = raw[i] * info->pixel_mdeg;
+		return n * sizeof(s32);
+	}
+
+	// Both models so far count 0.1 degC
+	if (info->ptat_mdeg == D6T_MDEG_PER_DECI &&
+	    info->pixel_mdeg == D6T_MDEG_PER_DECI) {
+		memcpy(deci, raw, n * sizeof(s16));
+		return n * sizeof(s16);
+	}
+	for (u32 i = 0; i < n; i++) {
+		v = raw[i] * (i ? info->pixel_mdeg : info->ptat_mdeg);
+		v = DIV_ROUND_CLOSEST(v, D6T_MDEG_PER_DECI);
+		deci[i] = clamp_t(s32, v, S16_MIN, S16_MAX);
+	}
+	return n * sizeof(s16);
+}
+
+#endif /* _D6T_TEMP_H */
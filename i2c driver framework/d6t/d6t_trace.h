@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_trace.h - tracepoints of the omron d6t drivers
+ *
+ * One frame goes through
+ *
+ *   d6t_xfer_start -> d6t_xfer_end -> d6t_pec -> d6t_convert -> d6t_deliver
+ *
+ * Sensors are identified by their /dev minor, which stays valid after
+ * the I2C client is gone. Durations are only measured while the
+ * matching event is enabled.
+ *
+ *   echo 1 > /sys/kernel/tracing/events/d6t/enable
+ *   cat /sys/kernel/tracing/trace_pipe
+ *
+ * Each module defines CREATE_TRACE_POINTS in one source before including
+ * this file, and builds with "ccflags-y += -I$(src)" so that
+ * trace/define_trace.h finds it again.
+*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM d6t
+
+#if !defined(_D6T_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _D6T_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(d6t_xfer_start,
+	TP_PROTO(int minor, u32 len, const char *strategy),
+	TP_ARGS(minor, len, strategy),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, len)
+		__string(strategy, strategy)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->len = len;
+		__assign_str(strategy);
+	),
+
+	TP_printk("minor=%d len=%u strategy=%s", __entry->minor, __entry->len,
+		  __get_str(strategy))
+);
+
+/* A stage of the frame path: bytes (or values) handled, result, time taken */
+DECLARE_EVENT_CLASS(d6t_stage,
+	TP_PROTO(int minor, u32 len, int ret, u64 duration_ns),
+	TP_ARGS(minor, len, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, len)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("minor=%d len=%u ret=%d duration_ns=%llu", __entry->minor,
+		  __entry->len, __entry->ret, __entry->duration_ns)
+);
+
+/* I2C read of one frame, len is the number of bytes requested */
+DEFINE_EVENT(d6t_stage, d6t_xfer_end,
+	TP_PROTO(int minor, u32 len, int ret, u64 duration_ns),
+	TP_ARGS(minor, len, ret, duration_ns)
+);
+
+/* Little-endian bytes to s16 values, len is the number of values */
+DEFINE_EVENT(d6t_stage, d6t_convert,
+	TP_PROTO(int minor, u32 len, int ret, u64 duration_ns),
+	TP_ARGS(minor, len, ret, duration_ns)
+);
+
+/* copy_to_user() of a frame, ret is what read()/ioctl() will return */
+DEFINE_EVENT(d6t_stage, d6t_deliver,
+	TP_PROTO(int minor, u32 len, int ret, u64 duration_ns),
+	TP_ARGS(minor, len, ret, duration_ns)
+);
+
+TRACE_EVENT(d6t_pec,
+	TP_PROTO(int minor, u32 len, u8 calc, u8 got),
+	TP_ARGS(minor, len, calc, got),
+
+	TP_STRUCT__entry(
+		__field(int, minor)
+		__field(u32, len)
+		__field(u8, calc)
+		__field(u8, got)
+	),
+
+	TP_fast_assign(
+		__entry->minor = minor;
+		__entry->len = len;
+		__entry->calc = calc;
+		__entry->got = got;
+	),
+
+	TP_printk("minor=%d len=%u calc=%02x got=%02x %s", __entry->minor,
+		  __entry->len, __entry->calc, __entry->got,
+		  __entry->calc == __entry->got ? "ok" : "FAIL")
+);
+
+#endif /* _D6T_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE d6t_trace
+#include <trace/define_trace.h>
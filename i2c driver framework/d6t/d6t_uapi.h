@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * d6t_uapi.h - userspace interface of the omron d6t drivers
+*/
+#ifndef _D6T_UAPI_H
+#define _D6T_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ================ MMAP FRAME RING ================
+ *
+ * mmap() of the d6t char device maps a ring of frames filled by the
+ * driver. Page 0 holds struct d6t_ring_hdr, slots start at data_offset
+ * and are slot_size bytes apart. The frame with sequence number seq
+ * (1-based) lives in slot (seq - 1) % depth.
+ *
+ * Reader protocol:
+ *  1. Wait until head >= next (next starts at 1).
+ *  2. Read the slot's d6t_frame_hdr.seq. If it equals next, use the
+ *     frame and check seq again afterwards: if it changed, the frame
+ *     was overwritten while being read and must be discarded.
+ *     If it is larger than next, frames were missed; jump to it.
+ *  3. Store next + 1 in tail. poll() reports POLLIN once head reaches
+ *     tail, and D6T_RING_DROP never overwrites frames at or after tail.
+ *
+ * slot.seq is 0 while the driver is writing a slot.
+ */
+#define D6T_RING_MAGIC 0x44365452 /* "D6TR" */
+#define D6T_RING_VERSION 1
+
+enum d6t_ring_policy {
+	D6T_RING_OVERWRITE = 0, // Oldest frame is overwritten when full
+	D6T_RING_DROP = 1, // New frames are dropped until tail advances
+};
+
+enum d6t_pec_status {
+	D6T_PEC_OK = 0,
+	D6T_PEC_FAIL = 1,
+};
+
+struct d6t_ring_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 depth; // Number of slots
+	__u32 policy; // enum d6t_ring_policy
+	__u32 slot_size; // Bytes between two slots
+	__u32 data_offset; // Offset of slot 0 from the start of the mapping
+	__u32 n_raw_data; // Values per frame (PTAT + pixels)
+	__u32 reserved;
+	__u64 head; // Sequence number of the newest frame (driver)
+	__u64 tail; // Next sequence number wanted (reader)
+	__u64 dropped; // Frames dropped because the ring was full
+};
+
+struct d6t_frame_hdr {
+	__u64 seq; // Frame sequence number, 0 while being written
+	__u64 timestamp_ns; // CLOCK_MONOTONIC time of capture
+	__u32 pec_status; // enum d6t_pec_status
+	__u32 len; // Bytes of frame data following this header
+	/* __s16 data[n_raw_data]: PTAT then pixels, as D6T_FORMAT_RAW */
+};
+
+/* ================ IOCTL ================ */
+#define D6T_IOC_MAGIC 'x'
+
+/*
+ * d6t_full: the model is named from userspace before frames can be read.
+ * INIT copies a char[32] model name, e.g. "d6t32l01a"; CLEAR undoes it.
+ */
+#define D6T_MODEL_NAME_MAX 32
+#define D6T_IOC_INIT _IOW(D6T_IOC_MAGIC, 0, char *)
+#define D6T_IOC_CLEAR _IO(D6T_IOC_MAGIC, 1)
+
+/* Newest frame as __s16[n_raw_data]: PTAT then pixels, as D6T_FORMAT_RAW */
+#define D6T_IOC_READ_RAW _IOR(D6T_IOC_MAGIC, 1, __u16 *)
+
+/*
+ * Batched read: up to max_frames frames this file has not seen yet,
+ * oldest first. Frame i goes to info[i] and to
+ * data[i * n_raw_data .. (i + 1) * n_raw_data - 1].
+ * Returns -ENOSPC with the required n_raw_data filled in when the
+ * caller's frame size is too small. n_frames may be 0.
+ */
+#define D6T_FRAMES_VERSION 1
+
+struct d6t_frame_info {
+	__u64 seq; // Frame sequence number, gaps mean lost frames
+	__u64 timestamp_ns; // CLOCK_MONOTONIC time of capture
+	__u32 dropped; // Frames lost since the previous frame of this file
+	__u32 flags; // D6T_FINFO_*
+};
+
+/*
+ * Same content as the frame before it: read before the sensor had a new
+ * one. Only frames read on demand can be duplicates, the acquisition
+ * thread skips them.
+ */
+#define D6T_FINFO_DUPLICATE 0x1
+
+struct d6t_read_frames {
+	__u32 version; // in: D6T_FRAMES_VERSION
+	__u32 max_frames; // in: capacity of info and data
+	__u32 n_raw_data; // in: values per frame in data, out: actual
+	__u32 n_frames; // out: frames returned
+	__u64 info_ptr; // in: struct d6t_frame_info[max_frames]
+	__u64 data_ptr; // in: __s16[max_frames * n_raw_data], as D6T_FORMAT_RAW
+};
+
+#define D6T_IOC_READ_FRAMES _IOWR(D6T_IOC_MAGIC, 0x10, struct d6t_read_frames)
+
+/*
+ * read() output format of the open file, PTAT first in all of them:
+ *  D6T_FORMAT_TEXT:  signed decimal sensor counts separated by spaces
+ *  D6T_FORMAT_RAW:   __s16[n_raw_data] sensor counts in CPU byte order;
+ *                    d6t01a and d6t32l01a count 0.1 degC
+ *  D6T_FORMAT_DELTA: one record per read(), see below
+ *  D6T_FORMAT_DECI:  __s16[n_raw_data], 0.1 degC on every model
+ *  D6T_FORMAT_MILLI: __s32[n_raw_data], 0.001 degC on every model
+ * Frame formats need count to hold a whole frame, -EINVAL otherwise.
+ */
+enum d6t_format {
+	D6T_FORMAT_TEXT = 0,
+	D6T_FORMAT_RAW = 1,
+	D6T_FORMAT_DELTA = 2,
+	D6T_FORMAT_DECI = 3,
+	D6T_FORMAT_MILLI = 4,
+};
+
+#define D6T_IOC_SET_FORMAT _IOW(D6T_IOC_MAGIC, 0x11, __u32)
+
+/*
+ * D6T_FORMAT_DELTA record: struct d6t_delta_hdr, then
+ *  D6T_DELTA_KEY set:   __s16[count], the whole frame as in D6T_FORMAT_RAW
+ *  D6T_DELTA_KEY clear: struct d6t_delta_px[count], the values that moved
+ *                       by more than threshold since the previous record
+ * Applying the records in order rebuilds the frame to within threshold.
+ * read() needs room for a keyframe, sizeof(hdr) + 2 * n_raw_data bytes,
+ * and fails with -EINVAL otherwise. The first record, and the first
+ * after D6T_IOC_SET_FORMAT, is a keyframe.
+ */
+#define D6T_DELTA_KEY 0x1
+
+struct d6t_delta_hdr {
+	__u32 seq; // Record number of this file, gaps never happen
+	__u16 flags; // D6T_DELTA_*
+	__u16 count; // Entries following the header
+};
+
+struct d6t_delta_px {
+	__u16 index; // Value index in the frame, 0 is PTAT
+	__s16 value; // New value, as D6T_FORMAT_RAW
+};
+
+struct d6t_delta_cfg {
+	__u32 threshold; // Changes up to this, in 0.1 degC, are not sent
+	__u32 key_interval; // Records per keyframe, 0 for keyframes only when needed
+};
+
+#define D6T_IOC_SET_DELTA _IOW(D6T_IOC_MAGIC, 0x12, struct d6t_delta_cfg)
+
+/*
+ * What the open device is and how frames can be taken from it.
+ * n_raw_data, row and col are 0 while the model is not known yet
+ * (d6t_full before its init ioctl).
+ */
+#define D6T_INFO_VERSION 1
+
+#define D6T_CAP_READ_RAW (1u << 0) // D6T_IOC_READ_RAW
+#define D6T_CAP_READ_FRAMES (1u << 1) // D6T_IOC_READ_FRAMES
+#define D6T_CAP_RING (1u << 2) // mmap() frame ring
+#define D6T_CAP_FMT_TEXT (1u << 3) // read() in D6T_FORMAT_TEXT
+#define D6T_CAP_FMT_RAW (1u << 4) // read() in D6T_FORMAT_RAW
+#define D6T_CAP_FMT_DELTA (1u << 5) // read() in D6T_FORMAT_DELTA
+#define D6T_CAP_CONFIG (1u << 6) // D6T_IOC_GET_CONFIG / D6T_IOC_SET_CONFIG
+#define D6T_CAP_FMT_DECI (1u << 7) // read() in D6T_FORMAT_DECI
+#define D6T_CAP_FMT_MILLI (1u << 8) // read() in D6T_FORMAT_MILLI
+
+struct d6t_dev_info {
+	__u32 version; // D6T_INFO_VERSION
+	__u32 caps; // D6T_CAP_*
+	__u16 n_raw_data; // Values per frame (PTAT + pixels)
+	__u8 row;
+	__u8 col;
+	__u16 cycle_ms; // Default sensor refresh period, see D6T_IOC_GET_CONFIG
+	__u16 format; // enum d6t_format of read() on this file, if any D6T_CAP_FMT_*
+	char model[16]; // e.g. "d6t32l01a", NUL terminated
+};
+
+#define D6T_IOC_GET_INFO _IOR(D6T_IOC_MAGIC, 0x13, struct d6t_dev_info)
+
+/*
+ * Sensor settings: a stronger IIR filter and more averaging lower the
+ * noise, a longer cycle gives the sensor time for both. Which settings
+ * a model has and the values it takes are reported in the out fields.
+ *
+ * GET_CONFIG reads the settings back from the sensor. SET_CONFIG writes
+ * the fields named in mask, leaves the others as they are and returns
+ * what the sensor reads back afterwards. It fails with -EOPNOTSUPP for
+ * a setting the model does not have, -EINVAL for a value out of range
+ * and -EIO if the sensor did not take the value.
+ */
+#define D6T_CFG_IIR (1u << 0)
+#define D6T_CFG_AVG (1u << 1)
+#define D6T_CFG_CYCLE (1u << 2)
+
+struct d6t_config {
+	__u32 mask; // in: D6T_CFG_* to set, out: D6T_CFG_* of the model
+	__u8 iir; // IIR filter setting, 0: off
+	__u8 avg; // Averaging setting, 0: off
+	__u16 cycle_ms; // Frame period, a multiple of cycle_unit_ms
+	__u8 iir_max; // out: highest iir
+	__u8 avg_max; // out: highest avg
+	__u16 cycle_unit_ms; // out: cycle_ms step
+	__u16 cycle_min_ms; // out
+	__u16 cycle_max_ms; // out
+};
+
+#define D6T_IOC_GET_CONFIG _IOR(D6T_IOC_MAGIC, 0x14, struct d6t_config)
+#define D6T_IOC_SET_CONFIG _IOWR(D6T_IOC_MAGIC, 0x15, struct d6t_config)
+
+#endif /* _D6T_UAPI_H */
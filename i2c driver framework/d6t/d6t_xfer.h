@@ -0,0 +1,225 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * d6t_xfer.h - frame transfer for the omron d6t drivers
+ *
+ * A frame is read by writing the command byte and reading n_read bytes
+ * back. The d6t32l01a frame (2051 bytes) is larger than what many
+ * adapters accept in one message, so the message layout is chosen from
+ * the adapter's i2c_adapter_quirks, fastest legal layout first:
+ *
+ *  combined: command + whole frame in one transfer (repeated START)
+ *  nostart:  as combined, the frame split into I2C_M_NOSTART reads
+ *  split:    command and frame in two transfers
+ *  chunked:  command, then one transfer per max_read_len chunk
+ *
+ * If the adapter still rejects a layout at run time, the next legal one
+ * is used from then on. -EOPNOTSUPP always counts as a rejection,
+ * -EINVAL only before the layout has completed a transfer: afterwards
+ * it is an ordinary bus error and must not pin a slower layout.
+*/
+#ifndef _D6T_XFER_H
+#define _D6T_XFER_H
+
+#include <linux/kernel.h>
+#include <linux/i2c.h>
+
+#define D6T_XFER_MAX_MSGS 16 // Command + read messages of one nostart transfer
+
+enum d6t_xfer_strategy {
+	D6T_XFER_COMBINED,
+	D6T_XFER_NOSTART,
+	D6T_XFER_SPLIT,
+	D6T_XFER_CHUNKED,
+	D6T_XFER_NR,
+};
+
+static const char *const d6t_xfer_names[D6T_XFER_NR] = {
+	[D6T_XFER_COMBINED] = "combined",
+	[D6T_XFER_NOSTART] = "nostart",
+	[D6T_XFER_SPLIT] = "split",
+	[D6T_XFER_CHUNKED] = "chunked",
+};
+
+struct d6t_xfer {
+	struct i2c_client *client;
+	u8 command;
+	u8 strategy; // enum d6t_xfer_strategy
+	u16 len; // Bytes per frame, PEC included
+	u16 chunk; // Bytes per read message
+	bool proven; // The current layout has completed a transfer
+};
+
+static inline bool d6t_quirk_exceeded(u16 val, u16 max)
+{
+	return max && val > max;
+}
+
+/*
+@brief Check whether the adapter accepts a layout for a len byte frame
+@param adap I2C adapter
+@param strategy layout to check
+@param len frame length in bytes
+@param chunk bytes per read message, set if the layout is legal
+@return true if the layout is legal
+*/
+static inline bool d6t_xfer_legal(struct i2c_adapter *adap,
+				  enum d6t_xfer_strategy strategy, u16 len,
+				  u16 *chunk)
+{
+	const struct i2c_adapter_quirks *q = adap->quirks;
+	u16 max_read = q ? q->max_read_len : 0;
+	u16 max_msgs = q ? q->max_num_msgs : 0;
+	u16 n;
+
+	switch (strategy) {
+	case D6T_XFER_COMBINED:
+		if (q && (q->flags & I2C_AQ_NO_REP_START))
+			return false;
+		// The core skips the per-message limits for combined messages
+		if (q && (q->flags & I2C_AQ_COMB)) {
+			if (d6t_quirk_exceeded(1, q->max_comb_1st_msg_len) ||
+			    d6t_quirk_exceeded(len, q->max_comb_2nd_msg_len))
+				return false;
+		} else if (d6t_quirk_exceeded(len, max_read)) {
+			return false;
+		}
+		if (d6t_quirk_exceeded(2, max_msgs))
+			return false;
+		*chunk = len;
+		return true;
+
+	case D6T_XFER_NOSTART:
+		// Only worth it when a single read message is too long
+		if (!max_read || (q->flags & I2C_AQ_NO_REP_START) ||
+		    !i2c_check_functionality(adap, I2C_FUNC_NOSTART))
+			return false;
+		n = 1 + DIV_ROUND_UP(len, max_read);
+		if (n > D6T_XFER_MAX_MSGS || d6t_quirk_exceeded(n, max_msgs))
+			return false;
+		*chunk = max_read;
+		return true;
+
+	case D6T_XFER_SPLIT:
+		if (d6t_quirk_exceeded(len, max_read))
+			return false;
+		*chunk = len;
+		return true;
+
+	case D6T_XFER_CHUNKED:
+		*chunk = max_read ? min(max_read, len) : len;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/*
+@brief Use the first legal layout at or after from
+@return 0, or -EOPNOTSUPP if none is left
+*/
+static inline int d6t_xfer_select(struct d6t_xfer *x,
+				  enum d6t_xfer_strategy from)
+{
+	for (int s = from; s < D6T_XFER_NR; s++) {
+		if (d6t_xfer_legal(x->client->adapter, s, x->len, &x->chunk)) {
+			x->strategy = s;
+			x->proven = false;
+			return 0;
+		}
+	}
+	return -EOPNOTSUPP;
+}
+
+/*
+@brief Pick the transfer layout for a sensor
+@param x transfer state, kept next to the frame buffer
+@param client sensor
+@param command frame read command of the model
+@param len frame length in bytes, PEC included
+@return 0, or -EOPNOTSUPP if the adapter cannot do plain I2C
+*/
+static inline int d6t_xfer_init(struct d6t_xfer *x, struct i2c_client *client,
+				u8 command, u16 len)
+{
+	x->client = client;
+	x->command = command;
+	x->len = len;
+	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C))
+		return -EOPNOTSUPP;
+	return d6t_xfer_select(x, D6T_XFER_COMBINED);
+}
+
+static inline const char *d6t_xfer_name(const struct d6t_xfer *x)
+{
+	return d6t_xfer_names[x->strategy];
+}
+
+static inline int d6t_xfer_check(int ret, int expected)
+{
+	if (ret < 0)
+		return ret;
+	return ret == expected ? 0 : -EIO;
+}
+
+static inline int d6t_xfer_do(struct d6t_xfer *x, u8 *buf)
+{
+	struct i2c_client *client = x->client;
+	struct i2c_msg msgs[D6T_XFER_MAX_MSGS];
+	u8 command = x->command;
+	u16 off;
+	int n, ret;
+
+	msgs[0] = (struct i2c_msg){
+		.addr = client->addr, .flags = 0, .len = 1, .buf = &command
+	};
+
+	if (x->strategy == D6T_XFER_COMBINED ||
+	    x->strategy == D6T_XFER_NOSTART) {
+		for (off = 0, n = 1; off < x->len; off += x->chunk, n++) {
+			msgs[n].addr = client->addr;
+			msgs[n].flags = I2C_M_RD | (n > 1 ? I2C_M_NOSTART : 0);
+			msgs[n].len = min_t(u16, x->chunk, x->len - off);
+			msgs[n].buf = buf + off;
+		}
+		return d6t_xfer_check(i2c_transfer(client->adapter, msgs, n), n);
+	}
+
+	// split / chunked: STOP after the command and after every chunk
+	ret = d6t_xfer_check(i2c_transfer(client->adapter, msgs, 1), 1);
+	for (off = 0; !ret && off < x->len; off += x->chunk) {
+		msgs[1].addr = client->addr;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = min_t(u16, x->chunk, x->len - off);
+		msgs[1].buf = buf + off;
+		ret = d6t_xfer_check(i2c_transfer(client->adapter, &msgs[1], 1),
+				     1);
+	}
+	return ret;
+}
+
+/*
+@brief Read one frame, falling back to the next layout if rejected
+@param x transfer state, serialized by the caller's bus lock
+@param buf len bytes
+@return 0 or negative errno
+*/
+static inline int d6t_xfer_read(struct d6t_xfer *x, u8 *buf)
+{
+	int ret;
+
+	for (;;) {
+		ret = d6t_xfer_do(x, buf);
+		if (!ret)
+			x->proven = true;
+		if (ret != -EOPNOTSUPP && (ret != -EINVAL || x->proven))
+			return ret;
+		if (d6t_xfer_select(x, x->strategy + 1))
+			return ret;
+		dev_warn(&x->client->dev,
+			 "Adapter rejected the transfer, falling back to %s\n",
+			 d6t_xfer_name(x));
+	}
+}
+
+#endif /* _D6T_XFER_H */
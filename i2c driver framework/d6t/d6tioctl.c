@@ -8,74 +8,102 @@
 #include <linux/ioctl.h>
 #include <linux/mutex.h>
 #include <linux/i2c.h>
+#include <linux/kthread.h>
+#include <linux/rwsem.h>
+#include <linux/jiffies.h>
+#include <linux/of.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include "d6t_crc.h"
+#include "d6t_info.h"
+#include "d6t_xfer.h"
+#include "d6t_uapi.h"
+#include "d6t_stats.h"
+#include "d6t_retry.h"
+#include "d6t_cadence.h"
+#include "d6t_config.h"
+#include "d6t_temp.h"
+
+#define CREATE_TRACE_POINTS
+#include "d6t_trace.h"
 
 #define DEVICE_NAME "d6t"
 #define CLASS_NAME  "d6t_class"
+#define D6T_MAX_DEVICES 16 // Minors reserved for /dev/d6t0..15
 
-#define N_PIXELS(row, col) ((row) * (col))
-#define N_READ(row, col) \
-	(2 * (1 + N_PIXELS(row, col)) + 1) // 2 bytes per pixel and PTAT + 1 byte for CRC
+#define D6T_HISTORY_MIN 2
+#define D6T_HISTORY_MAX 256
 
-#define NOT_SUPPORT 0xFF
-
-// IOCTL
-#define D6T_IOC_MAGIC  'x'
-#define D6T_IOC_READ_RAW _IOR(D6T_IOC_MAGIC, 1, uint16_t *)
-#define D6T_IOC_INIT  _IOW(D6T_IOC_MAGIC, 2, char *)  
-#define D6T_IOC_CLEAR _IO(D6T_IOC_MAGIC, 3)  
+// One captured, PEC-validated frame
+struct d6t_frame {
+	u64 seq;
+	u64 timestamp_ns; // CLOCK_MONOTONIC time the transfer started
+	u32 flags; // D6T_FINFO_*
+	s16 data[]; // Sensor counts, PTAT then pixels
+};
 
 struct d6t_info;
 struct d6t_data {
+	//One instance per probed sensor, found through i2c_get_clientdata()
+	struct i2c_client *client; // NULL once the sensor is removed
+	struct kref ref; // Held by probe and by every open file
+	struct cdev *cdev;
+	struct device *dev;
+	int minor;
+
 	//Manage d6t operation
-	struct d6t_info *d6t_info;
-	struct mutex lock;
+	const struct d6t_info *d6t_info;
+	struct mutex lock; // Serializes bus access, buf and back
 	u8 *buf;
-	u16 *raw;
 	u16 n_read; // Number of bytes to read
 	u16 n_raw_data; // Number of raw data points
+	struct d6t_xfer xfer; // Frame read layout for this adapter
+
+	//Frame history, fed by the acquisition thread or by direct reads
+	struct mutex acq_lock; // Serializes start/stop of the thread
+	struct task_struct *acq_task;
+	struct rw_semaphore cache_sem; // Protects hist, cache_valid, frame_seq
+	struct d6t_frame **hist; // Frame seq lives in hist[(seq - 1) % hist_depth]
+	u32 hist_depth;
+	struct d6t_frame *back; // Frame being filled, swapped into hist
+	bool cache_valid; // Newest frame comes from the running thread
+	u64 frame_seq; // Sequence number of the newest frame, 0 if none
+	wait_queue_head_t frame_wq; // Woken on every published frame
+
+	struct d6t_stats stats; // debugfs d6t/d6tN/stats
+	struct d6t_retry retry; // Frame read retries, under lock
+	struct d6t_cadence cadence; // When the sensor has a new frame, under lock
 };
 
-enum {
-	D6T_01A,
-	D6T_32L_01A,
+// Per open file state
+struct d6t_file {
+	struct d6t_data *d6t_data;
+	u64 seen_seq; // Last frame_seq handed to this file
 };
 
-struct d6t_info {
-	const char *model_name;
-	u8 command;
-	u8 row;
-	u8 col;
-	s8 status_reg;
-	s8 iir_avg_reg;
-	s8 cycle_reg;
-};
+static bool acquire;
+module_param(acquire, bool, 0444);
+MODULE_PARM_DESC(acquire,
+		 "Start background frame acquisition at probe (default: off)");
 
-struct d6t_info d6t_info_tbl[] = {
-	[D6T_01A] = { "d6t01a", 0x4C, 1, 1, NOT_SUPPORT, NOT_SUPPORT,
-		      NOT_SUPPORT },
-	[D6T_32L_01A] = { "d6t32l01a", 0x4D, 32, 32, 0x00, 0x01, 0x02 },
-	/* Add more models here if needed */
-};
+static unsigned int history = 16;
+module_param(history, uint, 0444);
+MODULE_PARM_DESC(history, "Frames kept for D6T_IOC_READ_FRAMES (2-256)");
 
-static struct i2c_client *d6t_client;
-static dev_t d6t_dev_num;
-static struct cdev d6t_cdev;
-static struct class *d6t_class;
-static struct d6t_data *d6t_data;
-struct device * d6t_dev;
+static struct d6t_retry_policy retry_policy = D6T_RETRY_POLICY_DEFAULT;
+D6T_RETRY_MODULE_PARAMS(retry_policy);
 
+// Shared by all sensors: one chrdev region and class, minor -> d6t_data
+static dev_t d6t_dev_base;
+static struct class *d6t_class;
+static struct dentry *d6t_debugfs_root;
+static DEFINE_IDR(d6t_idr);
+static DEFINE_MUTEX(d6t_idr_lock); // Protects d6t_idr and open() lookups
 
-static u8 d6t_crc8(u8 crc, u8 data)
-{
-    crc ^= data;
-    for (int i = 0; i < 8; i++) {
-        if (crc & 0x80)
-            crc = (crc << 1) ^ 0x07;
-        else
-            crc <<= 1;
-    }
-    return crc;
-}
 
 static bool d6t_checkPEC(struct i2c_client *client, struct d6t_data * d6t_data)
 {
@@ -83,13 +111,12 @@ static bool d6t_checkPEC(struct i2c_client *client, struct d6t_data * d6t_data)
     u8 crc = 0; // initial value
     u8 addr = (client->addr << 1) | 1; // I2C Read address (8 bit)
 
-    crc = d6t_crc8(crc, addr); // Start with address
-
-    for (u32 i = 0; i < n; i++) {
-        crc = d6t_crc8(crc, d6t_data->buf[i]);
-    }
+    crc = d6t_crc8_byte(crc, addr); // Start with address
+    crc = d6t_crc8(crc, d6t_data->buf, n);
 
+    trace_d6t_pec(d6t_data->minor, d6t_data->n_read, crc, d6t_data->buf[n]);
     if (crc !=  d6t_data->buf[n]) {
+        d6t_stats_inc(&d6t_data->stats, D6T_STAT_PEC_FAIL);
         pr_info("PEC check failed: calc=%02X get=%02X\n", crc, d6t_data->buf[n]);
         return true; // ERROR
     }
@@ -97,48 +124,328 @@ static bool d6t_checkPEC(struct i2c_client *client, struct d6t_data * d6t_data)
 }
 
 static int d6t_get_frame(struct i2c_client *d6t_client, struct d6t_data *d6t_data){
+	u64 t0, ns;
+	unsigned int n;
 	int ret;
-	struct i2c_msg msgs[2];
-	u8 command = d6t_data->d6t_info->command;
 
 	if (!d6t_client || !d6t_data || !d6t_data->buf) {
 		pr_err("D6T: Invalid client or data structure\n");
 		return -EINVAL;
 	}
-	
-	msgs[0].addr = d6t_client->addr;
-	msgs[0].flags = 0;
-	msgs[0].len = 1;
-	msgs[0].buf = &command;
-	
-	msgs[1].addr = d6t_client->addr;
-	msgs[1].flags = I2C_M_RD;
-	msgs[1].len = d6t_data->n_read;;
-	msgs[1].buf = d6t_data->buf;
-
-	memset(d6t_data->buf, 0, msgs[1].len);
-
-	ret = i2c_transfer(d6t_client->adapter, msgs, 2);
-	if (ret < 0) {
-		pr_err("D6T: I2C transfer failed: %d\n", ret);
+
+	// Sensor taken as down, see d6t_retry.h
+	ret = d6t_retry_begin(&d6t_data->retry, &retry_policy, &d6t_data->stats);
+	if (ret)
 		return ret;
+
+	memset(d6t_data->buf, 0, d6t_data->n_read);
+
+	for (n = 1;; n++) {
+		trace_d6t_xfer_start(d6t_data->minor, d6t_data->n_read,
+				     d6t_xfer_name(&d6t_data->xfer));
+		t0 = ktime_get_ns();
+		// Message layout follows the adapter quirks, see d6t_xfer.h
+		ret = d6t_xfer_read(&d6t_data->xfer, d6t_data->buf);
+		ns = ktime_get_ns() - t0;
+		trace_d6t_xfer_end(d6t_data->minor, d6t_data->n_read, ret, ns);
+		d6t_stats_xfer(&d6t_data->stats, d6t_data->n_read, ret, ns);
+		if (!ret || !d6t_retry_again(&d6t_data->retry, &retry_policy, n,
+					     &d6t_data->stats))
+			break;
 	}
-	
-	if (ret != 2) {
-		pr_err("D6T: I2C transfer returned %d messages, expected 2\n", ret);
-		return -EIO;
+	d6t_retry_end(&d6t_data->retry, &retry_policy, &d6t_data->xfer, ret,
+		      &d6t_data->stats);
+	if (ret < 0) {
+		pr_err("D6T: I2C transfer (%s) failed: %d\n",
+		       d6t_xfer_name(&d6t_data->xfer), ret);
+		return ret;
 	}
 	return 0;
 }
 
-static inline int d6t_convert_u8_to_s16(struct d6t_data *d6t_data){
+static inline int d6t_convert_u8_to_s16(struct d6t_data *d6t_data, s16 *dst){
 	u32 n = d6t_data->n_raw_data;
-	for (u32 i = 0; i < n; i++) {
-		d6t_data->raw[i] = (d6t_data->buf[2 * i + 1] << 8) | d6t_data->buf[2 * i];
+	u64 t0 = trace_d6t_convert_enabled() ? ktime_get_ns() : 0;
+
+	d6t_temp_counts(d6t_data->buf, dst, n);
+	if (t0)
+		trace_d6t_convert(d6t_data->minor, n, 0, ktime_get_ns() - t0);
+	return 0;
+}
+
+static struct d6t_frame *d6t_hist_frame(struct d6t_data *d6t_data, u64 seq)
+{
+	u32 idx;
+
+	div_u64_rem(seq - 1, d6t_data->hist_depth, &idx);
+	return d6t_data->hist[idx];
+}
+
+/*
+ * Read one frame from the sensor, verify its PEC and publish it as the
+ * newest history entry. Takes d6t_data->lock for the bus transfer.
+ * A repeat of the previous frame is dropped for the acquisition thread
+ * (-EAGAIN) and published with D6T_FINFO_DUPLICATE for direct reads.
+ */
+static int d6t_capture_frame(struct d6t_data *d6t_data, bool from_thread)
+{
+	struct d6t_frame *frame;
+	u64 t;
+	u32 idx;
+	bool dup;
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (!d6t_data->client) {
+		mutex_unlock(&d6t_data->lock);
+		return -ENODEV;
+	}
+	t = ktime_get_ns();
+	ret = d6t_get_frame(d6t_data->client, d6t_data);
+	if (!ret && d6t_checkPEC(d6t_data->client, d6t_data))
+		ret = -EIO;
+	if (ret) {
+		d6t_cadence_failed(&d6t_data->cadence, t);
+		mutex_unlock(&d6t_data->lock);
+		return ret;
+	}
+	dup = !d6t_cadence_frame(&d6t_data->cadence, t, d6t_data->buf,
+				 d6t_data->n_read, &d6t_data->stats);
+	if (dup && from_thread) {
+		mutex_unlock(&d6t_data->lock);
+		return -EAGAIN;
+	}
+	d6t_data->back->timestamp_ns = t;
+	d6t_data->back->flags = dup ? D6T_FINFO_DUPLICATE : 0;
+	d6t_convert_u8_to_s16(d6t_data, d6t_data->back->data);
+
+	// Publish: readers only ever see complete frames
+	down_write(&d6t_data->cache_sem);
+	div_u64_rem(d6t_data->frame_seq, d6t_data->hist_depth, &idx);
+	frame = d6t_data->back;
+	frame->seq = ++d6t_data->frame_seq;
+	d6t_data->back = d6t_data->hist[idx];
+	d6t_data->hist[idx] = frame;
+	d6t_data->cache_valid = from_thread;
+	up_write(&d6t_data->cache_sem);
+	mutex_unlock(&d6t_data->lock);
+
+	wake_up_interruptible(&d6t_data->frame_wq);
+	return 0;
+}
+
+/* ================= BACKGROUND ACQUISITION ================== */
+static int d6t_acq_thread(void *arg)
+{
+	struct d6t_data *d6t_data = arg;
+	u64 due;
+
+	while (!kthread_should_stop()) {
+		d6t_capture_frame(d6t_data, true);
+
+		// Just after the sensor's next frame, see d6t_cadence.h
+		mutex_lock(&d6t_data->lock);
+		due = d6t_data->cadence.next_ns;
+		mutex_unlock(&d6t_data->lock);
+		d6t_cadence_sleep_kthread(due);
 	}
 	return 0;
 }
 
+static int d6t_acq_start(struct d6t_data *d6t_data)
+{
+	struct task_struct *task;
+	int ret = 0;
+
+	mutex_lock(&d6t_data->acq_lock);
+	if (d6t_data->acq_task)
+		goto out;
+
+	task = kthread_run(d6t_acq_thread, d6t_data, "d6t-acq/%d",
+			   d6t_data->minor);
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		goto out;
+	}
+	d6t_data->acq_task = task;
+	pr_info("D6T: Background acquisition started\n");
+out:
+	mutex_unlock(&d6t_data->acq_lock);
+	return ret;
+}
+
+static void d6t_acq_stop(struct d6t_data *d6t_data)
+{
+	mutex_lock(&d6t_data->acq_lock);
+	if (d6t_data->acq_task) {
+		kthread_stop(d6t_data->acq_task);
+		d6t_data->acq_task = NULL;
+
+		// The cached frame goes stale from here on
+		down_write(&d6t_data->cache_sem);
+		d6t_data->cache_valid = false;
+		up_write(&d6t_data->cache_sem);
+		// Pollers fall back to direct reads, let them re-evaluate
+		wake_up_interruptible(&d6t_data->frame_wq);
+		pr_info("D6T: Background acquisition stopped\n");
+	}
+	mutex_unlock(&d6t_data->acq_lock);
+}
+
+/*
+ * Copy the newest frame to userspace and mark it seen by @f.
+ * Return -EAGAIN if no frame has been captured yet.
+ */
+static int d6t_copy_newest_frame(struct d6t_data *d6t_data, struct d6t_file *f,
+				 s16 __user *ubuf)
+{
+	u32 len = d6t_data->n_raw_data * sizeof(s16);
+	u64 t0 = trace_d6t_deliver_enabled() ? ktime_get_ns() : 0;
+	int ret = -EAGAIN;
+
+	down_read(&d6t_data->cache_sem);
+	if (d6t_data->frame_seq) {
+		ret = 0;
+		if (copy_to_user(ubuf,
+				 d6t_hist_frame(d6t_data, d6t_data->frame_seq)->data,
+				 len))
+			ret = -EFAULT;
+		else
+			f->seen_seq = d6t_data->frame_seq;
+	}
+	up_read(&d6t_data->cache_sem);
+
+	if (!ret)
+		d6t_stats_add(&d6t_data->stats, D6T_STAT_BYTES_OUT, len);
+
+	if (t0)
+		trace_d6t_deliver(d6t_data->minor, len, ret,
+				  ktime_get_ns() - t0);
+	return ret;
+}
+
+/*
+ * D6T_IOC_READ_FRAMES: hand out every frame @f has not seen yet, oldest
+ * first. Frames that already left the history are reported through the
+ * dropped count of the next frame returned.
+ */
+static int d6t_read_frames(struct d6t_data *d6t_data, struct d6t_file *f,
+			   struct d6t_read_frames __user *argp)
+{
+	struct d6t_read_frames req;
+	struct d6t_frame_info info = { 0 };
+	struct d6t_frame_info __user *uinfo;
+	s16 __user *udata;
+	struct d6t_frame *frame;
+	u64 seq, prev, oldest, t0;
+	u32 n = 0;
+	int ret = 0;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+	if (req.version != D6T_FRAMES_VERSION || !req.max_frames)
+		return -EINVAL;
+
+	// Tell the caller how large a frame is if its buffer is too small
+	if (req.n_raw_data < d6t_data->n_raw_data) {
+		req.n_raw_data = d6t_data->n_raw_data;
+		req.n_frames = 0;
+		return copy_to_user(argp, &req, sizeof(req)) ? -EFAULT : -ENOSPC;
+	}
+
+	// Without the acquisition thread nothing new arrives on its own
+	if (!READ_ONCE(d6t_data->acq_task)) {
+		ret = d6t_capture_frame(d6t_data, false);
+		if (ret)
+			return ret;
+	}
+
+	uinfo = u64_to_user_ptr(req.info_ptr);
+	udata = u64_to_user_ptr(req.data_ptr);
+
+	t0 = trace_d6t_deliver_enabled() ? ktime_get_ns() : 0;
+	down_read(&d6t_data->cache_sem);
+	prev = f->seen_seq;
+	oldest = d6t_data->frame_seq > d6t_data->hist_depth ?
+			 d6t_data->frame_seq - d6t_data->hist_depth + 1 :
+			 1;
+	for (seq = max(prev + 1, oldest);
+	     seq <= d6t_data->frame_seq && n < req.max_frames; seq++, n++) {
+		frame = d6t_hist_frame(d6t_data, seq);
+		info.seq = seq;
+		info.timestamp_ns = frame->timestamp_ns;
+		info.dropped = min_t(u64, seq - prev - 1, U32_MAX);
+		info.flags = frame->flags;
+		if (copy_to_user(&uinfo[n], &info, sizeof(info)) ||
+		    copy_to_user(udata + (size_t)n * req.n_raw_data, frame->data,
+				 d6t_data->n_raw_data * sizeof(s16))) {
+			ret = -EFAULT;
+			break;
+		}
+		prev = seq;
+	}
+	f->seen_seq = prev;
+	up_read(&d6t_data->cache_sem);
+
+	if (t0)
+		trace_d6t_deliver(d6t_data->minor,
+				  n * d6t_data->n_raw_data * sizeof(s16), ret,
+				  ktime_get_ns() - t0);
+
+	if (ret)
+		return ret;
+	d6t_stats_add(&d6t_data->stats, D6T_STAT_BYTES_OUT,
+		      n * d6t_data->n_raw_data * sizeof(s16));
+
+	req.n_frames = n;
+	req.n_raw_data = d6t_data->n_raw_data;
+	return copy_to_user(argp, &req, sizeof(req)) ? -EFAULT : 0;
+}
+
+static void d6t_free_history(struct d6t_data *d6t_data)
+{
+	if (d6t_data->hist) {
+		for (u32 i = 0; i < d6t_data->hist_depth; i++)
+			kfree(d6t_data->hist[i]);
+		kfree(d6t_data->hist);
+	}
+	kfree(d6t_data->back);
+	d6t_data->hist = NULL;
+	d6t_data->back = NULL;
+	d6t_data->hist_depth = 0;
+}
+
+static int d6t_alloc_history(struct d6t_data *d6t_data)
+{
+	size_t frame_size = struct_size(d6t_data->back, data,
+					d6t_data->n_raw_data);
+
+	d6t_data->hist_depth = clamp_t(u32, history, D6T_HISTORY_MIN,
+				       D6T_HISTORY_MAX);
+	d6t_data->hist = kcalloc(d6t_data->hist_depth,
+				 sizeof(*d6t_data->hist), GFP_KERNEL);
+	if (!d6t_data->hist)
+		goto err;
+
+	for (u32 i = 0; i < d6t_data->hist_depth; i++) {
+		d6t_data->hist[i] = kzalloc(frame_size, GFP_KERNEL);
+		if (!d6t_data->hist[i])
+			goto err;
+	}
+
+	d6t_data->back = kzalloc(frame_size, GFP_KERNEL);
+	if (!d6t_data->back)
+		goto err;
+
+	d6t_data->frame_seq = 0;
+	d6t_data->cache_valid = false;
+	return 0;
+
+err:
+	d6t_free_history(d6t_data);
+	return -ENOMEM;
+}
+
 static int d6t_init(struct d6t_data* d6t_data, const char *name)
 {
 	if (strcmp(name, "d6t01a") == 0)
@@ -153,6 +460,14 @@ static int d6t_init(struct d6t_data* d6t_data, const char *name)
 
 	d6t_data->n_read = N_READ(d6t_data->d6t_info->row, d6t_data->d6t_info->col);
 	d6t_data->n_raw_data = N_PIXELS(d6t_data->d6t_info->row, d6t_data->d6t_info->col) + 1; // +1 for PTAT
+
+	if (d6t_xfer_init(&d6t_data->xfer, d6t_data->client,
+			  d6t_data->d6t_info->command, d6t_data->n_read)) {
+		pr_err("D6T: Adapter cannot read a %u byte frame\n",
+		       d6t_data->n_read);
+		d6t_data->d6t_info = NULL;
+		return -EOPNOTSUPP;
+	}
 		
 	d6t_data->buf = kmalloc(d6t_data->n_read * sizeof(u8), GFP_KERNEL);
 	if (!d6t_data->buf) {
@@ -160,19 +475,51 @@ static int d6t_init(struct d6t_data* d6t_data, const char *name)
 		return -ENOMEM;
 	}
 
-	d6t_data->raw = kmalloc(d6t_data->n_raw_data * sizeof(u16), GFP_KERNEL);
-	if (!d6t_data->raw) {
+	d6t_cadence_init(&d6t_data->cadence, d6t_data->d6t_info->cycle_ms);
+
+	if (d6t_alloc_history(d6t_data)) {
 		kfree(d6t_data->buf);
-		pr_err("D6T: Failed to allocate raw data buffer\n");
+		pr_err("D6T: Failed to allocate frame history\n");
 		return -ENOMEM;
 	}
 
-	mutex_init(&d6t_data->lock);
-	pr_info("D6T: Initialized with model %s\n",
-		d6t_data->d6t_info->model_name);
+	pr_info("D6T: Initialized with model %s, %s transfers\n",
+		d6t_data->d6t_info->model_name, d6t_xfer_name(&d6t_data->xfer));
 	return 0;
 }
 
+// Sensor settings as read back, see d6t_config.h
+static int d6t_get_config(struct d6t_data *d6t_data, struct d6t_config *cfg)
+{
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (!d6t_data->client || !d6t_data->d6t_info)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_read(d6t_data->client, d6t_data->d6t_info, cfg);
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+
+// Apply the settings in cfg->mask, cfg gets what the sensor read back
+static int d6t_set_config(struct d6t_data *d6t_data, struct d6t_config *cfg)
+{
+	u32 mask = cfg->mask;
+	int ret;
+
+	mutex_lock(&d6t_data->lock);
+	if (!d6t_data->client || !d6t_data->d6t_info)
+		ret = -ENODEV;
+	else
+		ret = d6t_config_write(d6t_data->client, d6t_data->d6t_info, cfg);
+	// The acquisition thread follows the new period from its next frame
+	if (!ret && (mask & D6T_CFG_CYCLE))
+		d6t_cadence_init(&d6t_data->cadence, cfg->cycle_ms);
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+
 static int d6t_clear(struct d6t_data* d6t_data)
 {
 	if (!d6t_data->d6t_info) {
@@ -181,10 +528,9 @@ static int d6t_clear(struct d6t_data* d6t_data)
 	}
 
 	kfree(d6t_data->buf);
-	kfree(d6t_data->raw);
+	d6t_free_history(d6t_data);
 	d6t_data->d6t_info = NULL;
 	d6t_data->buf = NULL;
-	d6t_data->raw = NULL;
 	d6t_data->n_read = 0;
 	d6t_data->n_raw_data = 0;
 
@@ -196,22 +542,81 @@ static int d6t_clear(struct d6t_data* d6t_data)
 
 
 /* ================= FILE OPERATIONS ================== */
+static void d6t_data_release(struct kref *ref)
+{
+	struct d6t_data *d6t_data = container_of(ref, struct d6t_data, ref);
+
+	d6t_clear(d6t_data);
+	kfree(d6t_data);
+}
+
 static int d6t_open(struct inode *inode, struct file *file)
 {
-    d6t_init(d6t_data,"d6t32l01a");
-    pr_info("d6t: Device opened\n");
+    struct d6t_data *d6t_data;
+    struct d6t_file *f;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f)
+        return -ENOMEM;
+
+    // The sensor may be going away, only take a reference while it is listed
+    mutex_lock(&d6t_idr_lock);
+    d6t_data = idr_find(&d6t_idr, iminor(inode));
+    if (d6t_data)
+        kref_get(&d6t_data->ref);
+    mutex_unlock(&d6t_idr_lock);
+    if (!d6t_data) {
+        kfree(f);
+        return -ENODEV;
+    }
+
+    f->d6t_data = d6t_data;
+    file->private_data = f;
+
+    pr_info("d6t%d: Device opened\n", d6t_data->minor);
     return 0;
 }
 
 static int d6t_release(struct inode *inode, struct file *file)
 {
-    d6t_clear(d6t_data);
-    pr_info("d6t: Device closed\n");
+    struct d6t_file *f = file->private_data;
+
+    pr_info("d6t%d: Device closed\n", f->d6t_data->minor);
+    kref_put(&f->d6t_data->ref, d6t_data_release);
+    kfree(f);
     return 0;
 }
 
-static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+/*
+ * POLLIN when this file has not seen the newest cached frame yet.
+ * Without background acquisition every read goes to the bus, so the
+ * device is always readable.
+ */
+static __poll_t d6t_poll(struct file *file, poll_table *wait)
 {
+	struct d6t_file *f = file->private_data;
+	struct d6t_data *d6t_data = f->d6t_data;
+	__poll_t mask = 0;
+
+	if (!d6t_data || !d6t_data->d6t_info)
+		return EPOLLERR;
+
+	poll_wait(file, &d6t_data->frame_wq, wait);
+
+	down_read(&d6t_data->cache_sem);
+	if (!READ_ONCE(d6t_data->acq_task) ||
+	    (d6t_data->cache_valid && d6t_data->frame_seq != f->seen_seq))
+		mask = EPOLLIN | EPOLLRDNORM;
+	up_read(&d6t_data->cache_sem);
+
+	return mask;
+}
+
+static long __d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct d6t_file *f = file->private_data;
+    struct d6t_data *d6t_data = f->d6t_data;
+
     if (_IOC_TYPE(cmd) != D6T_IOC_MAGIC)
         return -ENOTTY;
 
@@ -220,51 +625,59 @@ static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     {
         int ret;
         //struct d6t_data *d6t_data = file->private_data;
-        if (!d6t_data || !d6t_data->d6t_info || !d6t_data->buf || !d6t_data->raw) {
+        if (!d6t_data || !d6t_data->d6t_info || !d6t_data->buf || !d6t_data->hist) {
             pr_err("D6T: Device not initialized or memory not allocated\n");
             return -EINVAL;
         }
 
-        mutex_lock(&d6t_data->lock);
-
-        if (d6t_get_frame(d6t_client, d6t_data) < 0) {
-            mutex_unlock(&d6t_data->lock);
-            return -EIO;
-        }
-
-        if (d6t_checkPEC(d6t_client, d6t_data)) {
-            mutex_unlock(&d6t_data->lock);
-            return -EIO;
+        // Served from memory while background acquisition is running
+        if (!READ_ONCE(d6t_data->acq_task) || !READ_ONCE(d6t_data->cache_valid)) {
+            ret = d6t_capture_frame(d6t_data, false);
+            if (ret)
+                return ret;
         }
 
-        d6t_convert_u8_to_s16(d6t_data);
-        ret = copy_to_user((uint16_t __user *)arg, d6t_data->raw, d6t_data->n_raw_data * sizeof(u16));
-	    mutex_unlock(&d6t_data->lock);
+        ret = d6t_copy_newest_frame(d6t_data, f,
+                                    (s16 __user *)arg);
         if (ret) {
             pr_err("D6T: Failed to copy data to user space\n");
+            return ret;
+        }
+        break;
+    }
+    case D6T_IOC_READ_FRAMES:
+        if (!d6t_data || !d6t_data->d6t_info || !d6t_data->hist)
+            return -EINVAL;
+        return d6t_read_frames(d6t_data, f,
+                               (struct d6t_read_frames __user *)arg);
+    case D6T_IOC_GET_INFO:
+    {
+        struct d6t_dev_info info;
+
+        d6t_info_fill(&info, d6t_data->d6t_info,
+                      D6T_CAP_READ_RAW | D6T_CAP_READ_FRAMES | D6T_CAP_CONFIG,
+                      D6T_FORMAT_RAW);
+        if (copy_to_user((void __user *)arg, &info, sizeof(info)))
             return -EFAULT;
+        break;
+    }
+    case D6T_IOC_GET_CONFIG:
+    case D6T_IOC_SET_CONFIG:
+    {
+        struct d6t_config cfg;
+        int ret;
+
+        if (cmd == D6T_IOC_SET_CONFIG) {
+            if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+                return -EFAULT;
+            ret = d6t_set_config(d6t_data, &cfg);
+        } else {
+            ret = d6t_get_config(d6t_data, &cfg);
         }
-        
-        
-        //size_t bytes = RAW_SIZE * sizeof(uint16_t);
-        // uint16_t *tmp = kmalloc(bytes, GFP_KERNEL);
-        //if (!tmp) return -ENOMEM;
-    
-        // // Fake d? li?u h?p lý
-        // tmp[0] = 25; // PTAT
-        // int i;
-        // for (i = 1; i < RAW_SIZE; i++)
-        //     tmp[i] = i % 50; // pixel 0–49
-    
-        // if (copy_to_user((uint16_t __user *)arg, tmp, bytes)) {
-        //     kfree(tmp);
-        //     return -EFAULT;
-        // }
-
-        // pr_info("d6t: PTAT=%d, Pixel[0]=%d ... Pixel[1023]=%d\n",
-        //         tmp[0], tmp[1], tmp[RAW_SIZE-1]);
-    
-        // kfree(tmp);
+        if (ret)
+            return ret;
+        if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+            return -EFAULT;
         break;
     }
     default:
@@ -274,78 +687,211 @@ static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     return 0;
 }
 
+static long d6t_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct d6t_file *f = file->private_data;
+    u64 t0 = ktime_get_ns();
+    long ret = __d6t_ioctl(file, cmd, arg);
+
+    // Only the frame reads go into the call histogram
+    if (cmd == D6T_IOC_READ_RAW || cmd == D6T_IOC_READ_FRAMES)
+        d6t_stats_call(&f->d6t_data->stats, ret, ktime_get_ns() - t0);
+    return ret;
+}
+
 static const struct file_operations d6t_fops = {
     .owner = THIS_MODULE,
     .open = d6t_open,
     .release = d6t_release,
     .unlocked_ioctl = d6t_ioctl,
+    .poll = d6t_poll,
 };
 
 
+/* ================= SYSFS ================== */
+static ssize_t acquire_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct d6t_data *d6t_data = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", d6t_data->acq_task ? 1 : 0);
+}
+
+static ssize_t acquire_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct d6t_data *d6t_data = dev_get_drvdata(dev);
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	if (enable) {
+		ret = d6t_acq_start(d6t_data);
+		if (ret)
+			return ret;
+	} else {
+		d6t_acq_stop(d6t_data);
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(acquire);
+
+// Message layout currently used for frame reads, see d6t_xfer.h
+static ssize_t xfer_strategy_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct d6t_data *d6t_data = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&d6t_data->lock);
+	ret = sysfs_emit(buf, "%s %u\n", d6t_xfer_name(&d6t_data->xfer),
+			 d6t_data->xfer.chunk);
+	mutex_unlock(&d6t_data->lock);
+	return ret;
+}
+static DEVICE_ATTR_RO(xfer_strategy);
+
+// Sensor settings, read back from the sensor on every access
+D6T_CONFIG_ATTR(iir, D6T_CFG_IIR, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(avg, D6T_CFG_AVG, d6t_get_config, d6t_set_config);
+D6T_CONFIG_ATTR(cycle_ms, D6T_CFG_CYCLE, d6t_get_config, d6t_set_config);
+
+static struct attribute *d6t_attrs[] = {
+	&dev_attr_acquire.attr,
+	&dev_attr_xfer_strategy.attr,
+	&dev_attr_iir.attr,
+	&dev_attr_avg.attr,
+	&dev_attr_cycle_ms.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(d6t);
+
 /* ================= DEVICE MATCH ================== */
+/*
+ * Model comes from the DT "model" property or the i2c id table,
+ * falling back to d6t32l01a (the only model the old open() supported).
+ */
+static const char *d6t_model_name(struct i2c_client *client)
+{
+	const struct i2c_device_id *id = i2c_client_get_device_id(client);
+	const char *model_name;
+
+	if (client->dev.of_node &&
+	    !of_property_read_string(client->dev.of_node, "model", &model_name))
+		return model_name;
+	if (id && strcmp(id->name, "d6t") != 0)
+		return id->name;
+	return d6t_info_tbl[D6T_32L_01A].model_name;
+}
+
 static int d6t_probe(struct i2c_client *client)
 {
+    struct d6t_data *d6t_data;
     int ret;
 
-    d6t_client = client;
+    d6t_data = kzalloc(sizeof(*d6t_data), GFP_KERNEL);
+    if (!d6t_data)
+        return -ENOMEM;
 
-    ret = alloc_chrdev_region(&d6t_dev_num, 0, 1, DEVICE_NAME);
-    if (ret < 0)
-        return ret;
+    d6t_data->client = client;
+    kref_init(&d6t_data->ref);
+    mutex_init(&d6t_data->lock);
+    mutex_init(&d6t_data->acq_lock);
+    init_rwsem(&d6t_data->cache_sem);
+    init_waitqueue_head(&d6t_data->frame_wq);
 
-    cdev_init(&d6t_cdev, &d6t_fops);
-    d6t_cdev.owner = THIS_MODULE;
-    ret = cdev_add(&d6t_cdev, d6t_dev_num, 1);
+    ret = d6t_init(d6t_data, d6t_model_name(client));
     if (ret < 0)
-        goto unregister_region;
-
-    d6t_class = class_create(CLASS_NAME);
-    if (IS_ERR(d6t_class)) {
-        ret = PTR_ERR(d6t_class);
-        goto del_cdev;
+        goto free_data;
+
+    // Not visible to open() until the node exists
+    mutex_lock(&d6t_idr_lock);
+    ret = idr_alloc(&d6t_idr, NULL, 0, D6T_MAX_DEVICES, GFP_KERNEL);
+    mutex_unlock(&d6t_idr_lock);
+    if (ret < 0) {
+        dev_err(&client->dev, "No free d6t minor (max %d sensors)\n",
+                D6T_MAX_DEVICES);
+        goto clear_data;
     }
+    d6t_data->minor = ret;
 
-    d6t_dev = device_create(d6t_class, NULL, d6t_dev_num, NULL, DEVICE_NAME);
-    if (IS_ERR(d6t_dev)) {
-        ret = PTR_ERR(d6t_dev);
-        goto destroy_class;
+    d6t_data->cdev = cdev_alloc();
+    if (!d6t_data->cdev) {
+        ret = -ENOMEM;
+        goto free_minor;
+    }
+    d6t_data->cdev->ops = &d6t_fops;
+    d6t_data->cdev->owner = THIS_MODULE;
+    ret = cdev_add(d6t_data->cdev, d6t_dev_base + d6t_data->minor, 1);
+    if (ret < 0) {
+        kobject_put(&d6t_data->cdev->kobj);
+        goto free_minor;
     }
 
-    d6t_data = kzalloc(sizeof(*d6t_data), GFP_KERNEL);
-    if (!d6t_data) {
-        ret = -ENOMEM;
-        goto destroy_device;
+    d6t_data->dev = device_create_with_groups(d6t_class, &client->dev,
+                                              d6t_dev_base + d6t_data->minor,
+                                              d6t_data, d6t_groups,
+                                              DEVICE_NAME "%d", d6t_data->minor);
+    if (IS_ERR(d6t_data->dev)) {
+        ret = PTR_ERR(d6t_data->dev);
+        goto del_cdev;
     }
 
-    mutex_init(&d6t_data->lock);
+    d6t_stats_init(&d6t_data->stats, d6t_debugfs_root,
+                   dev_name(d6t_data->dev));
+
+    i2c_set_clientdata(client, d6t_data);
+    mutex_lock(&d6t_idr_lock);
+    idr_replace(&d6t_idr, d6t_data, d6t_data->minor);
+    mutex_unlock(&d6t_idr_lock);
+
+    if (acquire) {
+        ret = d6t_acq_start(d6t_data);
+        if (ret < 0)
+            dev_warn(&client->dev,
+                     "Failed to start acquisition: %d\n", ret);
+    }
 
-    pr_info("d6t: %s probed successfully\n", client->name);
+    dev_info(&client->dev, "%s probed as /dev/" DEVICE_NAME "%d\n",
+             client->name, d6t_data->minor);
     return 0;
 
-destroy_device:
-    device_destroy(d6t_class, d6t_dev_num);
-destroy_class:
-    class_destroy(d6t_class);
 del_cdev:
-    cdev_del(&d6t_cdev);
-unregister_region:
-    unregister_chrdev_region(d6t_dev_num, 1);
+    cdev_del(d6t_data->cdev);
+free_minor:
+    mutex_lock(&d6t_idr_lock);
+    idr_remove(&d6t_idr, d6t_data->minor);
+    mutex_unlock(&d6t_idr_lock);
+clear_data:
+    d6t_clear(d6t_data);
+free_data:
+    kfree(d6t_data);
     return ret;
 }
 
 static void d6t_remove(struct i2c_client *client)
 {
-    if (d6t_data) {
-        kfree(d6t_data);
-        d6t_data = NULL;
-    }
-    if (d6t_dev)
-        device_destroy(d6t_class, d6t_dev_num);
-    if (!IS_ERR_OR_NULL(d6t_class))
-        class_destroy(d6t_class);
+    struct d6t_data *d6t_data = i2c_get_clientdata(client);
+
+    // No new opens, and the sysfs knob goes before the thread is stopped
+    mutex_lock(&d6t_idr_lock);
+    idr_remove(&d6t_idr, d6t_data->minor);
+    mutex_unlock(&d6t_idr_lock);
+    d6t_stats_remove(&d6t_data->stats);
+    device_destroy(d6t_class, d6t_dev_base + d6t_data->minor);
+    cdev_del(d6t_data->cdev);
+
+    d6t_acq_stop(d6t_data);
 
-    cdev_del(&d6t_cdev);
-    unregister_chrdev_region(d6t_dev_num, 1);
+    // Files still open get -ENODEV, memory goes with the last reference
+    mutex_lock(&d6t_data->lock);
+    d6t_data->client = NULL;
+    mutex_unlock(&d6t_data->lock);
+    wake_up_interruptible(&d6t_data->frame_wq);
+    kref_put(&d6t_data->ref, d6t_data_release);
 
     dev_info(&client->dev, "d6t removed\n");
 }
@@ -375,7 +921,46 @@ static struct i2c_driver d6t_driver = {
     .id_table = d6t_id,
 };
 
-module_i2c_driver(d6t_driver);
+static int __init d6t_module_init(void)
+{
+    int ret;
+
+    ret = alloc_chrdev_region(&d6t_dev_base, 0, D6T_MAX_DEVICES, DEVICE_NAME);
+    if (ret < 0)
+        return ret;
+
+    d6t_class = class_create(CLASS_NAME);
+    if (IS_ERR(d6t_class)) {
+        ret = PTR_ERR(d6t_class);
+        goto unregister_region;
+    }
+
+    d6t_debugfs_root = debugfs_create_dir("d6t", NULL);
+
+    ret = i2c_add_driver(&d6t_driver);
+    if (ret < 0)
+        goto remove_debugfs;
+    return 0;
+
+remove_debugfs:
+    debugfs_remove(d6t_debugfs_root);
+    class_destroy(d6t_class);
+unregister_region:
+    unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+    return ret;
+}
+
+static void __exit d6t_module_exit(void)
+{
+    i2c_del_driver(&d6t_driver);
+    debugfs_remove(d6t_debugfs_root);
+    class_destroy(d6t_class);
+    unregister_chrdev_region(d6t_dev_base, D6T_MAX_DEVICES);
+    idr_destroy(&d6t_idr);
+}
+
+module_init(d6t_module_init);
+module_exit(d6t_module_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("NGUYEN DUY BACH");
@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * libd6t.c - userspace client of the omron d6t char drivers
+ *
+ * Copyright (C) 2025-26 by Duy Bach Nguyen
+ */
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "libd6t.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define D6T_BATCH 8 // Frames per D6T_IOC_READ_FRAMES call
+#define D6T_LIST_MAX 64
+
+struct d6t_dev {
+    int fd;
+    enum d6t_access access;
+    struct d6t_dev_info info;
+
+    // D6T_ACCESS_RING
+    void *map;
+    size_t map_len;
+    struct d6t_ring_hdr *hdr;
+    uint64_t next; // Sequence number wanted next
+
+    // D6T_ACCESS_FRAMES / D6T_ACCESS_READ: frames copied out of the driver
+    uint16_t *buf; // D6T_BATCH frames
+    struct d6t_frame_info finfo[D6T_BATCH];
+    uint32_t batch_n; // Frames in buf
+    uint32_t batch_pos; // Next frame of buf to hand out
+    uint64_t seq; // Last sequence number handed out
+};
+
+static const char *const d6t_access_names[] = {
+    [D6T_ACCESS_RING] = "ring",
+    [D6T_ACCESS_FRAMES] = "frames",
+    [D6T_ACCESS_READ] = "read",
+};
+
+static uint64_t d6t_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* ================ DISCOVERY ================ */
+// "d6t3" / "D6T3": prefix, then the minor number
+static int d6t_node_minor(const char *name)
+{
+    if (strncasecmp(name, "d6t", 3) || !name[3])
+        return -1;
+    for (const char *p = name + 3; *p; p++)
+        if (!isdigit((unsigned char)*p))
+            return -1;
+    return atoi(name + 3);
+}
+
+// Sorts "/dev/..." paths by node name
+static int d6t_node_cmp(const void *a, const void *b)
+{
+    const char *x = (const char *)a + 5, *y = (const char *)b + 5;
+    // d6t_full/d6tioctl ("d6t") before d6t32l ("D6T"), unlike ASCII order
+    int c = (x[0] == 'D') - (y[0] == 'D');
+
+    return c ? c : d6t_node_minor(x) - d6t_node_minor(y);
+}
+
+int d6t_list(char paths[][D6T_PATH_MAX], int max)
+{
+    char names[D6T_LIST_MAX][D6T_PATH_MAX];
+    struct dirent *de;
+    DIR *dir;
+    int n = 0;
+
+    dir = opendir("/dev");
+    if (!dir)
+        return -errno;
+    while ((de = readdir(dir)) && n < D6T_LIST_MAX) {
+        if (d6t_node_minor(de->d_name) < 0 ||
+            strlen(de->d_name) >= D6T_PATH_MAX - 5)
+            continue;
+        strcpy(stpcpy(names[n++], "/dev/"), de->d_name);
+    }
+    closedir(dir);
+
+    qsort(names, n, sizeof(names[0]), d6t_node_cmp);
+    for (int i = 0; i < n && i < max; i++)
+        memcpy(paths[i], names[i], D6T_PATH_MAX);
+    return n;
+}
+
+/* ================ SETUP ================ */
+static int d6t_get_info(struct d6t_dev *dev)
+{
+    if (ioctl(dev->fd, D6T_IOC_GET_INFO, &dev->info) < 0)
+        return errno == ENOTTY ? -EOPNOTSUPP : -errno;
+    if (dev->info.version != D6T_INFO_VERSION)
+        return -EPROTO;
+    return 0;
+}
+
+// d6t_full learns the model from userspace
+static int d6t_set_model(struct d6t_dev *dev, const char *model)
+{
+    char name[D6T_MODEL_NAME_MAX] = { 0 };
+
+    if (!model)
+        return -ENODATA;
+    strncpy(name, model, sizeof(name) - 1);
+    if (ioctl(dev->fd, D6T_IOC_INIT, name) < 0)
+        return -errno;
+    return d6t_get_info(dev);
+}
+
+// Map the header page, then the whole ring it describes
+static int d6t_ring_setup(struct d6t_dev *dev)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct d6t_ring_hdr *hdr;
+    size_t len;
+
+    hdr = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (hdr == MAP_FAILED)
+        return -errno;
+    if (hdr->magic != D6T_RING_MAGIC || hdr->version != D6T_RING_VERSION ||
+        hdr->n_raw_data != dev->info.n_raw_data) {
+        munmap(hdr, page);
+        return -EPROTO;
+    }
+    len = hdr->data_offset + (size_t)hdr->depth * hdr->slot_size;
+    len = (len + page - 1) / page * page;
+    munmap(hdr, page);
+
+    dev->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if (dev->map == MAP_FAILED) {
+        dev->map = NULL;
+        return -errno;
+    }
+    dev->map_len = len;
+    dev->hdr = dev->map;
+    // Start with the next frame, what is in the ring may be old
+    dev->next = __atomic_load_n(&dev->hdr->head, __ATOMIC_ACQUIRE) + 1;
+    return 0;
+}
+
+static int d6t_copy_setup(struct d6t_dev *dev, enum d6t_access access)
+{
+    uint32_t format = D6T_FORMAT_RAW;
+
+    if (access == D6T_ACCESS_READ &&
+        ioctl(dev->fd, D6T_IOC_SET_FORMAT, &format) < 0)
+        return -errno;
+
+    dev->buf = calloc((size_t)D6T_BATCH * dev->info.n_raw_data,
+                      sizeof(*dev->buf));
+    if (!dev->buf)
+        return -ENOMEM;
+    dev->access = access;
+    return 0;
+}
+
+static int d6t_access_setup(struct d6t_dev *dev)
+{
+    uint32_t caps = dev->info.caps;
+
+    if ((caps & D6T_CAP_RING) && !d6t_ring_setup(dev)) {
+        dev->access = D6T_ACCESS_RING;
+        return 0;
+    }
+    if (caps & (D6T_CAP_READ_FRAMES | D6T_CAP_READ_RAW))
+        return d6t_copy_setup(dev, D6T_ACCESS_FRAMES);
+    if (caps & D6T_CAP_FMT_RAW)
+        return d6t_copy_setup(dev, D6T_ACCESS_READ);
+    return -EOPNOTSUPP;
+}
+
+struct d6t_dev *d6t_open(const char *path, const char *model)
+{
+    char first[1][D6T_PATH_MAX];
+    struct d6t_dev *dev;
+    int ret;
+
+    if (!path) {
+        if (d6t_list(first, 1) < 1) {
+            errno = ENODEV;
+            return NULL;
+        }
+        path = first[0];
+    }
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    dev->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (dev->fd < 0) {
+        free(dev);
+        return NULL;
+    }
+
+    ret = d6t_get_info(dev);
+    if (!ret && !dev->info.n_raw_data)
+        ret = d6t_set_model(dev, model);
+    if (!ret)
+        ret = d6t_access_setup(dev);
+    if (ret) {
+        d6t_close(dev);
+        errno = -ret;
+        return NULL;
+    }
+    return dev;
+}
+
+void d6t_close(struct d6t_dev *dev)
+{
+    if (!dev)
+        return;
+    if (dev->map)
+        munmap(dev->map, dev->map_len);
+    close(dev->fd);
+    free(dev->buf);
+    free(dev);
+}
+
+const struct d6t_dev_info *d6t_info(const struct d6t_dev *dev)
+{
+    return &dev->info;
+}
+
+enum d6t_access d6t_access(const struct d6t_dev *dev)
+{
+    return dev->access;
+}
+
+const char *d6t_access_name(const struct d6t_dev *dev)
+{
+    return d6t_access_names[dev->access];
+}
+
+int d6t_fd(const struct d6t_dev *dev)
+{
+    return dev->fd;
+}
+
+/* ================ SETTINGS ================ */
+int d6t_get_config(struct d6t_dev *dev, struct d6t_config *cfg)
+{
+    if (!(dev->info.caps & D6T_CAP_CONFIG))
+        return -EOPNOTSUPP;
+    if (ioctl(dev->fd, D6T_IOC_GET_CONFIG, cfg) < 0)
+        return -errno;
+    return 0;
+}
+
+int d6t_set_config(struct d6t_dev *dev, struct d6t_config *cfg)
+{
+    if (!(dev->info.caps & D6T_CAP_CONFIG))
+        return -EOPNOTSUPP;
+    if (ioctl(dev->fd, D6T_IOC_SET_CONFIG, cfg) < 0)
+        return -errno;
+    return 0;
+}
+
+/* ================ FRAMES ================ */
+static int d6t_wait(struct d6t_dev *dev, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+    int ret;
+
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return -errno;
+    if (ret == 0)
+        return -ETIMEDOUT;
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return -EIO;
+    return 0;
+}
+
+static struct d6t_frame_hdr *d6t_ring_slot(const struct d6t_dev *dev,
+                                           uint64_t seq)
+{
+    const struct d6t_ring_hdr *hdr = dev->hdr;
+
+    return (struct d6t_frame_hdr *)((char *)dev->map + hdr->data_offset +
+                                    (seq - 1) % hdr->depth * hdr->slot_size);
+}
+
+// Ring reader protocol of d6t_uapi.h, the frame stays in the ring
+static int d6t_ring_next(struct d6t_dev *dev, struct d6t_frame *frame,
+                         int timeout_ms)
+{
+    struct d6t_ring_hdr *hdr = dev->hdr;
+    struct d6t_frame_hdr *fh;
+    uint64_t head, seq;
+    int ret;
+
+    for (;;) {
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (head < dev->next) {
+            __atomic_store_n(&hdr->tail, dev->next, __ATOMIC_RELEASE);
+            ret = d6t_wait(dev, timeout_ms);
+            if (ret)
+                return ret;
+            continue;
+        }
+
+        // Too far behind, older slots are already reused
+        if (head - dev->next >= hdr->depth)
+            dev->next = head - hdr->depth + 1;
+
+        fh = d6t_ring_slot(dev, dev->next);
+        seq = __atomic_load_n(&fh->seq, __ATOMIC_ACQUIRE);
+        if (seq != dev->next) {
+            // Overwritten or being written, move on
+            dev->next = seq > dev->next ? seq : dev->next + 1;
+            continue;
+        }
+
+        // Keep the frame from a D6T_RING_DROP producer while it is used
+        __atomic_store_n(&hdr->tail, seq, __ATOMIC_RELEASE);
+        frame->data = (const uint16_t *)(fh + 1);
+        frame->seq = seq;
+        frame->timestamp_ns = fh->timestamp_ns;
+        frame->flags = fh->pec_status == D6T_PEC_FAIL ? D6T_FRAME_PEC_FAIL : 0;
+        dev->next = seq + 1;
+        return 0;
+    }
+}
+
+static int d6t_read_frames_batch(struct d6t_dev *dev)
+{
+    struct d6t_read_frames req = {
+        .version = D6T_FRAMES_VERSION,
+        .max_frames = D6T_BATCH,
+        .n_raw_data = dev->info.n_raw_data,
+        .info_ptr = (uintptr_t)dev->finfo,
+        .data_ptr = (uintptr_t)dev->buf,
+    };
+
+    if (!(dev->info.caps & D6T_CAP_READ_FRAMES))
+        return 0;
+    if (ioctl(dev->fd, D6T_IOC_READ_FRAMES, &req) < 0)
+        return -errno;
+    dev->batch_n = req.n_frames;
+    dev->batch_pos = 0;
+    return req.n_frames;
+}
+
+// One frame straight from the bus, for drivers not acquiring by themselves
+static int d6t_copy_one(struct d6t_dev *dev)
+{
+    size_t len = dev->info.n_raw_data * sizeof(uint16_t);
+    ssize_t n;
+
+    if (dev->access == D6T_ACCESS_READ) {
+        n = pread(dev->fd, dev->buf, len, 0);
+        if (n < 0)
+            return -errno;
+        if ((size_t)n != len)
+            return -EIO;
+    } else if (ioctl(dev->fd, D6T_IOC_READ_RAW, dev->buf) < 0) {
+        return -errno;
+    }
+
+    dev->finfo[0] = (struct d6t_frame_info){
+        .seq = dev->seq + 1,
+        .timestamp_ns = d6t_now_ns(),
+    };
+    dev->batch_n = 1;
+    dev->batch_pos = 0;
+    return 1;
+}
+
+/*
+ * d6tioctl hands out cached frames in batches while it acquires in the
+ * background; otherwise poll() is always ready and READ_FRAMES comes
+ * back empty, and the frame is read from the bus.
+ */
+static int d6t_copy_next(struct d6t_dev *dev, struct d6t_frame *frame,
+                         int timeout_ms)
+{
+    const struct d6t_frame_info *fi;
+    int ret;
+
+    if (dev->batch_pos >= dev->batch_n) {
+        ret = d6t_read_frames_batch(dev);
+        if (ret == 0) {
+            ret = d6t_wait(dev, timeout_ms);
+            if (!ret)
+                ret = d6t_read_frames_batch(dev);
+            if (ret == 0)
+                ret = d6t_copy_one(dev);
+        }
+        if (ret < 0)
+            return ret;
+    }
+
+    fi = &dev->finfo[dev->batch_pos];
+    frame->data = dev->buf + (size_t)dev->batch_pos * dev->info.n_raw_data;
+    frame->seq = fi->seq;
+    frame->timestamp_ns = fi->timestamp_ns;
+    frame->flags = fi->flags & D6T_FINFO_DUPLICATE ? D6T_FRAME_DUPLICATE : 0;
+    dev->seq = fi->seq;
+    dev->batch_pos++;
+    return 0;
+}
+
+int d6t_next_frame(struct d6t_dev *dev, struct d6t_frame *frame,
+                   int timeout_ms)
+{
+    if (dev->access == D6T_ACCESS_RING)
+        return d6t_ring_next(dev, frame, timeout_ms);
+    return d6t_copy_next(dev, frame, timeout_ms);
+}
+
+bool d6t_frame_valid(const struct d6t_dev *dev, const struct d6t_frame *frame)
+{
+    const struct d6t_frame_hdr *fh;
+
+    if (dev->access != D6T_ACCESS_RING)
+        return true;
+    fh = d6t_ring_slot(dev, frame->seq);
+    return __atomic_load_n(&fh->seq, __ATOMIC_ACQUIRE) == frame->seq;
+}
+
+/* ================ CONVERSION ================ */
+void d6t_to_celsius(const uint16_t *raw, float *out, size_t n)
+{
+    const int16_t *in = (const int16_t *)raw;
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+
+        vst1q_f32(out + i, vmulq_n_f32(lo, 0.1f));
+        vst1q_f32(out + i + 4, vmulq_n_f32(hi, 0.1f));
+    }
+#elif defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(0.1f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        // Sign extend: value in the upper half, then shift it down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[i] * 0.1f;
+}
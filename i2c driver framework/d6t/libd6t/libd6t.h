@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * libd6t.h - userspace client of the omron d6t char drivers
+ *
+ * Works with d6t_full (/dev/d6tN, mmap ring), d6tioctl (/dev/d6tN,
+ * ioctl) and d6t32l (/dev/D6TN, read). The geometry comes from
+ * D6T_IOC_GET_INFO and frames are taken the cheapest way the driver
+ * offers:
+ *
+ *   ring:   zero-copy view into the mmap ring (d6t_full)
+ *   frames: D6T_IOC_READ_FRAMES, several frames per syscall (d6tioctl)
+ *   read:   read() in D6T_FORMAT_RAW (d6t32l, d6t_full without mmap)
+ *
+ *   struct d6t_dev *dev = d6t_open(NULL, "d6t32l01a");
+ *   struct d6t_frame fr;
+ *   float t[1025];
+ *
+ *   while (d6t_next_frame(dev, &fr, 1000) == 0) {
+ *       d6t_to_celsius(fr.data, t, d6t_info(dev)->n_raw_data);
+ *       if (d6t_frame_valid(dev, &fr))
+ *           use(t);
+ *   }
+ *   d6t_close(dev);
+ *
+ * Build: gcc -O2 -fPIC -shared -o libd6t.so libd6t.c
+ *
+ * Functions returning int give 0 or a negative errno.
+ */
+#ifndef _LIBD6T_H
+#define _LIBD6T_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../d6t_uapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define D6T_PATH_MAX 32
+
+enum d6t_access {
+    D6T_ACCESS_RING,
+    D6T_ACCESS_FRAMES,
+    D6T_ACCESS_READ,
+};
+
+#define D6T_FRAME_PEC_FAIL 0x1 // Frame failed the PEC check (ring only)
+#define D6T_FRAME_DUPLICATE 0x2 // Sensor had not updated since the last frame (frames only)
+
+struct d6t_frame {
+    const uint16_t *data; // n_raw_data values, PTAT first, s16 0.1 degC
+    uint64_t seq; // Frame number, gaps mean lost frames
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC time of capture
+    uint32_t flags; // D6T_FRAME_*
+};
+
+struct d6t_dev;
+
+/*
+@brief List the d6t device nodes in /dev
+@param paths filled with up to max paths
+@return number of nodes found, may be larger than max
+*/
+int d6t_list(char paths[][D6T_PATH_MAX], int max);
+
+/*
+@brief Open a sensor
+@param path device node, NULL for the first one d6t_list() finds
+@param model model to set up if the driver does not know it yet
+       (d6t_full), NULL to fail instead
+@return device, or NULL with errno set
+*/
+struct d6t_dev *d6t_open(const char *path, const char *model);
+
+void d6t_close(struct d6t_dev *dev);
+
+const struct d6t_dev_info *d6t_info(const struct d6t_dev *dev);
+enum d6t_access d6t_access(const struct d6t_dev *dev);
+const char *d6t_access_name(const struct d6t_dev *dev);
+int d6t_fd(const struct d6t_dev *dev);
+
+/*
+@brief Read the IIR, averaging and cycle settings back from the sensor
+@param cfg filled in, see struct d6t_config
+@return 0, -EOPNOTSUPP if the driver has no settings, or another negative errno
+*/
+int d6t_get_config(struct d6t_dev *dev, struct d6t_config *cfg);
+
+/*
+@brief Change the settings named in cfg->mask
+@param cfg in: D6T_CFG_* mask and values, out: as d6t_get_config()
+@return 0, -EINVAL for a value out of range, -EOPNOTSUPP for a setting
+        the model lacks, or another negative errno
+*/
+int d6t_set_config(struct d6t_dev *dev, struct d6t_config *cfg);
+
+/*
+@brief Wait for the next frame
+@param frame filled in; data stays valid until the next call
+@param timeout_ms -1 waits forever
+@return 0, -ETIMEDOUT or another negative errno
+*/
+int d6t_next_frame(struct d6t_dev *dev, struct d6t_frame *frame,
+                   int timeout_ms);
+
+/*
+@brief Check a frame after use
+@return false if a ring frame was overwritten while being used; copied
+        frames are always valid
+*/
+bool d6t_frame_valid(const struct d6t_dev *dev, const struct d6t_frame *frame);
+
+/*
+@brief Convert raw values to degC, vectorised where the CPU allows
+@param raw s16 values in 0.1 degC
+@param out n floats
+*/
+void d6t_to_celsius(const uint16_t *raw, float *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBD6T_H */